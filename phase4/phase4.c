@@ -1,3 +1,5 @@
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <usloss.h>
@@ -6,6 +8,7 @@
 #include "phase2.h"
 #include "phase3.h"
 #include "phase4.h"
+#include "phase4_disk_sched.h"
 
 // Sys call handler declaration
 void Sleep_handler(USLOSS_Sysargs *args);
@@ -14,35 +17,147 @@ void TermWrite_handler(USLOSS_Sysargs *args);
 void DiskSize_handler(USLOSS_Sysargs *args);
 void DiskRead_handler(USLOSS_Sysargs *args);
 void DiskWrite_handler(USLOSS_Sysargs *args);
+void DiskCopy_handler(USLOSS_Sysargs *args);
+void DiskFill_handler(USLOSS_Sysargs *args);
+void DiskStats_handler(USLOSS_Sysargs *args);
+void Spawn_handler(USLOSS_Sysargs *args);
+void DiskSetLimit_handler(USLOSS_Sysargs *args);
+void DiskGetLimit_handler(USLOSS_Sysargs *args);
+void DiskResync_handler(USLOSS_Sysargs *args);
+void DiskTrace_handler(USLOSS_Sysargs *args);
+void KTrace_handler(USLOSS_Sysargs *args);
+void ProcIO_handler(USLOSS_Sysargs *args);
+void Terminate_handler(USLOSS_Sysargs *args);
+void Profile_handler(USLOSS_Sysargs *args);
+void TermCQCreate_handler(USLOSS_Sysargs *args);
+void TermCQRelease_handler(USLOSS_Sysargs *args);
+void TermReadAsync_handler(USLOSS_Sysargs *args);
+void TermWriteAsync_handler(USLOSS_Sysargs *args);
+void TermComplete_handler(USLOSS_Sysargs *args);
+void Batch_handler(USLOSS_Sysargs *args);
+void IoSetup_handler(USLOSS_Sysargs *args);
+void IoEnter_handler(USLOSS_Sysargs *args);
+
+// Length of a sleep_daemon tick, i.e. between phase 2's clock reports
+#define CLOCK_TICK_US 100000
+
+// Clock-tick profile: slots in the per-process sample table
+#define PROFILE_PIDS (2*MAXPROC)
+
+// Subsystems whose tracepoints are compiled in, as a mask of
+// 1<<KTRACE_SLEEP, 1<<KTRACE_DISK and 1<<KTRACE_TERM; override with e.g.
+// -DKTRACE_MASK=7. Tracepoints of other subsystems compile to nothing.
+#ifndef KTRACE_MASK
+#define KTRACE_MASK 0
+#endif
+
+#define KTRACE(subsystem, event, arg1, arg2) \
+	do { \
+		if(KTRACE_MASK & (1<<(subsystem))) \
+			ktrace(subsystem, event, arg1, arg2); \
+	} while(0)
+
+// Set to 1 (-DPROC_IO_DUMP=1) to print each process's I/O accounting to
+// the console when it terminates
+#ifndef PROC_IO_DUMP
+#define PROC_IO_DUMP 0
+#endif
+
+// Terminal metrics_daemon writes a snapshot of the kernel's counters to,
+// every METRICS_INTERVAL clock ticks (of 100ms); -1 (the default) leaves the
+// daemon out. E.g. -DMETRICS_TERM=3.
+#ifndef METRICS_TERM
+#define METRICS_TERM -1
+#endif
+#if METRICS_TERM >= USLOSS_TERM_UNITS
+#error "METRICS_TERM is not a terminal unit"
+#endif
+#ifndef METRICS_INTERVAL
+#define METRICS_INTERVAL 10
+#endif
+
+// Asynchronous terminal I/O: completion queues, and requests that can be
+// outstanding on all of them together
+#define TERM_CQ_MAX 16
+#define TERM_ASYNC_POOL (2*TERM_ASYNC_MAX)
+
+// Submission/completion rings that can be registered at once
+#define IO_RING_MAX 8
 
-#define TRACE 0
-#define DEBUG 0
-
-#define READ 0
-#define WRITE 1
 #define SIZE 2
 
 #define MAX_TERM_BUFFERS 10
 
-typedef struct sleep_list_node {
-	int pid;
-	long wake_up_time;
-	struct sleep_list_node* next;
-}sleep_list_node;
+// Read-ahead cache: sectors per unit, and bounds of the adaptive window
+#define RA_CACHE_SECTORS 64
+#define RA_MIN_WINDOW 4
+#define RA_MAX_WINDOW 32
+
+// Token buckets hold at most this many seconds' worth of I/O
+#define DISK_QOS_BURST 1
+
+// Mirrored unit: tracks it can cover, what one queued request costs in
+// tracks of seek distance when choosing where to read, and the priority
+// resync runs at
+#define MIRROR_MAX_TRACKS 1024
+#define MIRROR_QUEUE_COST 4
+#define MIRROR_RESYNC_PRIORITY 5
+
+// Striped unit: a request is queued in pieces of at most one stripe, which
+// is one track, and at most this many pieces are in flight per caller
+#define STRIPE_MAX_CHUNKS 8
+
+// DiskCopy moves data through two kernel buffers of this many sectors
+#define DISK_COPY_CHUNK 16
+
+// DiskFill patterns held in kernel blocks at once
+#define DISK_FILL_BLOCKS 4
+
+// Status processes are blocked with while on a wait queue
+#define WAIT_BLOCK_STATUS 40
 
-typedef struct disk_list_node{
+// A process blocked on a wait queue. The entry lives on the waiter's stack
+// and is unlinked by whoever wakes it, before it is unblocked.
+typedef struct wait_entry {
 	int pid;
-	int started;
-	int mailbox_num;
-	char* buffer;
-	int track;
-	int sectors;
-	int sectors_done;
-	int start_block;
-	int operation;
-	int response_status;
-	struct disk_list_node* next;
-}disk_list_node;
+	long key;
+	int status;             // given by the waker, returned by wait_on
+	struct wait_entry* next;
+} wait_entry;
+
+// Processes waiting for something, woken by another process. Ordered
+// queues are kept in increasing key order, equal keys first come first
+// served; the others are plain FIFOs. Only touched with interrupts off,
+// see wait_lock().
+typedef struct wait_queue {
+	int ordered;
+	wait_entry* head;
+	wait_entry* tail;
+	int waiting;
+	int waits;              // times a process blocked here
+	int wakeups;
+} wait_queue;
+
+// What a caller waits on for the disk requests it queued; see disk_done_init()
+typedef struct disk_done {
+	int pending;
+	wait_queue waiters;
+	void (*complete)(disk_list_node* node);  // if set, called instead for each request
+} disk_done;
+
+typedef struct ra_cache_entry {
+	int valid;
+	int used;
+	int lba;
+	char data[512];
+} ra_cache_entry;
+
+typedef struct ra_stream {
+	int pid;
+	int unit;
+	int next_lba;
+	int window;
+} ra_stream;
 
 typedef struct term_data {
 	int read_mb;
@@ -51,32 +166,294 @@ typedef struct term_data {
 } term_data;
 
 term_data terminals[USLOSS_MAX_UNITS];
-typedef struct track_list_node{
-	int mailbox_num;
-	int response;
-	struct track_list_node* next;
-}track_list_node;
+
+typedef struct term_async {
+	int cq;                 // -1 for a request from an io ring
+	int ring;               // ... which reports to this ring instead
+	long user_data;         // ... with this
+	int tag;
+	int operation;
+	int unit;
+	char* buffer;           // read: the caller's buffer
+	int size;               // read: size of buffer; write: length of data
+	char data[MAXLINE+1];   // write: copy of the line
+	struct term_async* next;
+} term_async;
+
+// A disk request or timeout taken from an io ring, from a fixed pool
+typedef struct io_request {
+	int ring;
+	long user_data;
+	int unit;               // disk: physical unit it was queued on
+	long deadline;          // timeout: tick it expires at
+	disk_list_node node;
+	disk_done done;
+	struct io_request* next;
+} io_request;
+
+// Kernel side of a registered io ring. Changed with interrupts off, like
+// the wait queue, as the daemons post completions.
+typedef struct io_ring_state {
+	io_ring* ring;          // in the owner's memory; NULL while the slot is free
+	int pid;
+	int inflight;           // taken from sq but not yet posted to cq
+	int want;               // completions the owner is waiting for
+	int closing;            // owner is quitting: completions are dropped
+	wait_queue waiters;
+} io_ring_state;
+
+// One sector holding a DiskFill pattern, shared by all fills using it
+typedef struct disk_fill_block {
+	int pattern;            // -1 until first used
+	int users;
+	char data[512];
+} disk_fill_block;
+
+typedef struct term_cq {
+	int mailbox_num;        // -1 while unused
+	int outstanding;        // requests not yet taken with TermComplete
+	int pid;                // creator, the only process that may release it
+} term_cq;
 
 long time_counter;
 int curr_track;
-int track_count0;
-int track_count1;
-sleep_list_node* sleep_list;
+// Published to the user library through sys_info_page. A unit's geometry is
+// filled in once, tracks last, and never changed after, so it is read
+// without a lock.
+sys_info sys_info_block;
+const sys_info* sys_info_page = &sys_info_block;
+
+// Sleepers, keyed by the tick to wake at
+wait_queue sleep_queue;
+
+// Processes waiting for a unit to be probed, keyed by unit
+wait_queue disk_probe_queue;
+
+// Every wait on any queue, for metrics_daemon
+int wait_blocks;
+int wait_wakeups;
+
+// Operations being carried out by each disk daemon; the head is the one
+// in progress
 disk_list_node* disk_list0;
 disk_list_node* disk_list1;
 
-track_list_node* track_list0;
-track_list_node* track_list1;
+// Operations waiting to be dispatched, in arrival order
+disk_list_node* disk_read_queue[2];
+disk_list_node* disk_write_queue[2];
+int disk_batch_op[2];
+int disk_batch_count[2];
+int disk_head_track[2];
+
+// Read-ahead state, per unit except for the per-process stream detector
+ra_cache_entry ra_cache[2][RA_CACHE_SECTORS];
+int ra_cache_next[2];
+ra_stream ra_streams[MAXPROC];
+disk_list_node ra_node[2];
+int ra_start_lba[2];
+char ra_buffer[2][RA_MAX_WINDOW*512];
+
+// DiskCopy reads one chunk into a buffer while the other is written out
+char disk_copy_buffer[2][DISK_COPY_CHUNK*512];
+int disk_copy_mutex_mailbox_num;
+
+// Pattern blocks for DiskFill; a fill waits on the queue for a free one
+disk_fill_block disk_fill_blocks[DISK_FILL_BLOCKS];
+wait_queue disk_fill_queue;
+
+disk_stats disk_unit_stats[2];
+
+// Per-process data, indexed by pid % MAXPROC
+proc_data procs[MAXPROC];
+
+// Spawns in progress, latest last. A child with a higher priority than its
+// parent runs, and may do I/O, before Spawn_handler can record it.
+typedef struct spawn_pending {
+	int parent;
+	int priority;
+} spawn_pending;
+spawn_pending spawns[MAXPROC];
+int spawn_depth;
+
+// Per-unit trace of what the disk path did, overwritten oldest first.
+// disk_trace_total counts every record ever made. disk_trace_ids numbers
+// the requests, so records of one request can be told apart from another's.
+disk_trace_record disk_trace_ring[2][DISK_TRACE_RECORDS];
+int disk_trace_total[2];
+int disk_trace_ids[2];
+
+// Kernel event trace, one ring per subsystem; see ktrace()
+ktrace_record ktrace_ring[KTRACE_SUBSYSTEMS][KTRACE_RECORDS];
+int ktrace_total[KTRACE_SUBSYSTEMS];
+
+// Set while a unit has waiting requests but every one of them is
+// throttled; the daemon is then idle until sleep_daemon refills a bucket
+// and pokes it. Whoever clears it (with interrupts off) owns the restart.
+int disk_stalled[2];
+
+// Time of the last token bucket refill
+int qos_last_refill;
+
+// Set once any process has been given a disk limit
+int qos_enabled;
+
+// Mirrored unit: tracks of each half that are out of date, and how many
+int mirror_dirty[2][MIRROR_MAX_TRACKS];
+int mirror_dirty_count[2];
+
+// Mirror writes in progress. Resync waits on mirror_drain_queue for them
+// to finish before copying a track. Neither holds mirror_mutex_mailbox_num
+// across its disk I/O.
+int mirror_active_writes;
+int mirror_mutex_mailbox_num;
+wait_queue mirror_drain_queue;
+
+// Set while mirror_daemon copies a track; writes that start meanwhile wait
+// on mirror_turn_queue, so resync and writes take turns
+int mirror_resync_busy;
+wait_queue mirror_turn_queue;
+
+// Wakes mirror_daemon when tracks become dirty
+int mirror_resync_signalled;
+wait_queue mirror_resync_queue;
+
+// Counters only kept for metrics_daemon, which sleep_daemon wakes through
+// metrics_queue every METRICS_INTERVAL ticks
+int metrics_due;
+wait_queue metrics_queue;
+int term_lines_in[USLOSS_TERM_UNITS];
+int term_lines_dropped[USLOSS_TERM_UNITS];
+int term_lines_out[USLOSS_TERM_UNITS];
+int sleep_wakeups;
+int lock_waits;
+long lock_wait_time;
+char mirror_buffer[16*512];
+
+// Asynchronous terminal requests: a fixed pool, the requests waiting on each
+// terminal in arrival order, the write each term_daemon has taken off its
+// queue, and the completion queues they report to. All guarded by
+// term_async_mutex_mailbox_num. The daemons skip the lock until
+// term_async_used says a queue or ring has been made, as until then there
+// can be no requests.
+term_async term_async_pool[TERM_ASYNC_POOL];
+term_async* term_async_free;
+term_async* term_async_reads[USLOSS_TERM_UNITS];
+term_async* term_async_writes[USLOSS_TERM_UNITS];
+term_async* term_async_writing[USLOSS_TERM_UNITS];
+int term_async_used;
+term_cq term_cqs[TERM_CQ_MAX];
+int term_async_mutex_mailbox_num;
+
+// Registered io rings, their disk and timeout requests, and the pending
+// timeouts in expiry order, which sleep_daemon posts
+io_ring_state io_rings[IO_RING_MAX];
+io_request io_request_pool[IO_RING_MAX*IO_RING_ENTRIES];
+io_request* io_request_free_list;
+io_request* io_timeouts;
+
+// Phase 3's SYS_SPAWN handler, wrapped to learn each child's priority
+void (*phase3_spawn_handler)(USLOSS_Sysargs *args);
+
+// Phase 3's SYS_TERMINATE handler, wrapped to dump I/O accounting
+void (*phase3_terminate_handler)(USLOSS_Sysargs *args);
+
+// Clock-tick profile, filled in from the clock interrupt while
+// profile_running. Samples go to the process's slot in an open-addressed
+// table; profile_ticks counts them all, including any that found no slot.
+profile_sample profile_table[PROFILE_PIDS];
+int profile_running;
+int profile_ticks;
+
+// The clock interrupt handler installed by the lower phases, wrapped to
+// take profile samples
+void (*phase2_clock_interrupt)(int dev, void* arg);
+void profile_clock_interrupt(int dev, void* arg);
 
 int sleep_daemon(char*);
 int disk_daemon(char*);
 int term_daemon(char*);
-void get_track_count(int unit);
-int get_tracks(char* args);
-void wait_get_tracks(int unit);	
+int metrics_daemon(char*);
+void metrics_send(int termNum, char* line);
+void disk_probe(int unit);
+int disk_wait_probe(int unit);
+int disk_probed(void* unit);
 void disk_helper(USLOSS_Sysargs* args, int operation);
-
-void add_sleep_list(int pid, long wake_up_time);
+int disk_args_valid(USLOSS_Sysargs* args);
+int disk_unit_valid(int unit);
+int disk_unit_sectors(int unit);
+int disk_unit_io(int unit, int operation, char* buffer, int track, int start_block, int sectors_num);
+void disk_helper_done(USLOSS_Sysargs* args, int operation, int status);
+int disk_io(int unit, int operation, char* buffer, int track, int start_block, int sectors_num);
+int disk_io_start(int unit, int operation, char* buffer, int track, int start_block, int sectors_num, disk_list_node* node, disk_done* done);
+int batch_allowed(int number);
+int batch_disk_run(USLOSS_Sysargs* calls, int count);
+void batch_disk(USLOSS_Sysargs* calls, int count);
+int disk_copy(int src_unit, int src, int dst_unit, int dst, int sectors);
+void disk_copy_lock();
+void disk_copy_unlock();
+int disk_fill(int unit, int track, int first, int sectors, int pattern);
+char* disk_fill_get(int pattern);
+void disk_fill_put(char* data);
+int disk_fill_available(void* arg);
+int io_submit(int id, io_sqe* sqe);
+void io_post(int id, long user_data, int result);
+int io_ring_ready(void* state);
+void io_ring_release(int pid);
+io_request* io_request_alloc(int id, long user_data);
+void io_request_free(io_request* req);
+void io_disk_complete(disk_list_node* node);
+void disk_account(int pid, int operation, int sectors);
+void io_timeout_add(io_request* req);
+void io_timeout_expire(long now);
+void io_timeout_cancel(int id);
+void disk_node_init(disk_list_node* node, int operation, char* buffer, int track, int start_block, int sectors, disk_done* done);
+void disk_done_init(disk_done* done, int pending);
+int disk_done_ready(void* done);
+void disk_done_signal(disk_list_node* node);
+void disk_submit(int unit, disk_list_node* node);
+void disk_sector_request(int unit, disk_list_node* node, USLOSS_DeviceRequest* req);
+void disk_record_latency(int unit, disk_list_node* node);
+void disk_qos_refill(void);
+void disk_kick(int unit);
+void disk_poke(int unit);
+void disk_trace(int unit, int event, disk_list_node* node, int arg);
+void ktrace(int subsystem, int event, int arg1, int arg2);
+void proc_io_disk(disk_list_node* node);
+void proc_io_dump(int pid);
+void lock_wait(int mailbox_num);
+
+int stripe_io(int operation, char* buffer, int track, int start_block, int sectors);
+
+int mirror_daemon(char*);
+int mirror_read(char* buffer, int track, int start_block, int sectors);
+int mirror_write(char* buffer, int track, int start_block, int sectors);
+int mirror_pick(int track, int start_block, int sectors);
+int mirror_is_dirty(int unit, int track, int start_block, int sectors);
+void mirror_mark_dirty(int unit, int first_track, int last_track);
+int mirror_find_dirty(int* unit);
+int mirror_drained(void* arg);
+int mirror_resync_idle(void* arg);
+void mirror_lock();
+void mirror_unlock();
+
+ra_stream* ra_get_stream(int unit);
+int ra_cache_read(int unit, int lba, int sectors, char* buffer);
+void ra_cache_install(int unit);
+void ra_cache_invalidate(int unit, int lba);
+
+unsigned int wait_lock(void);
+void wait_unlock(unsigned int psr);
+void wait_queue_init(wait_queue* queue, int ordered);
+int wait_on(wait_queue* queue, long key);
+int wait_on_unless(wait_queue* queue, long key, int (*ready)(void*), void* arg);
+int wait_flag_set(void* flag);
+int wake_one(wait_queue* queue, int status);
+int wake_all(wait_queue* queue, int status);
+int wake_until(wait_queue* queue, long key, int status);
+int wake_if(wait_queue* queue, int (*match)(wait_entry*, void*), void* arg, int status);
+int wake_key(wait_queue* queue, long key, int status);
+int wait_key_equal(wait_entry* entry, void* key);
+void wait_unblock(wait_entry* woken, int status);
 
 int terminal_locks[USLOSS_MAX_UNITS];
 void terminal_lock(int termNum);
@@ -85,6 +462,18 @@ void terminal_unlock(int termNum);
 void termWriting(int termNum, char* to_write);
 void termReading(int termNum);
 
+term_async* term_async_alloc(int cq);
+void term_async_start(term_async* req);
+void term_async_append(term_async** queue, term_async* req);
+term_async* term_async_pop(term_async** queue);
+void term_async_finish(term_async* req, int count);
+void term_async_cancel(int cq, int ring);
+void term_cq_release(int cq);
+void term_cq_release_owned(int pid);
+int term_async_copy(term_async* req, char* line);
+void term_async_lock();
+void term_async_unlock();
+
 int disk0_mutex_mailbox_num;
 void disk_lock0();
 void disk_unlock0();
@@ -93,21 +482,14 @@ int disk1_mutex_mailbox_num;
 void disk_lock1();
 void disk_unlock1();
 
-int track_count0_mutex_mailbox_num;
-void track_count_lock0();
-void track_count_unlock0();
-
-int track_count1_mutex_mailbox_num;
-void track_count_lock1();
-void track_count_unlock1();
+proc_data* proc_get(int pid);
+int proc_get_priority(int pid);
+int proc_new_priority(int pid);
 
-int track_list0_mutex_mailbox_num;
-void track_list_lock0();
-void track_list_unlock0();
-
-int track_list1_mutex_mailbox_num;
-void track_list_lock1();
-void track_list_unlock1();
+void disk_lock(int unit);
+void disk_unlock(int unit);
+disk_list_node** disk_queue(int unit);
+int disk_track_count(int unit);
 
 // Core Functions
 /////////////////////////////////////////////////////////////////////////////////
@@ -121,8 +503,17 @@ void track_list_unlock1();
 void phase4_init(void) {
 	time_counter = 0;
 	curr_track = 0;
-	track_count0 = -1;
-	track_count1 = -1;
+	for(int i=0; i<2; i++){
+		sys_info_block.disks[i].sector_size = USLOSS_DISK_SECTOR_SIZE;
+		sys_info_block.disks[i].sectors_per_track = USLOSS_DISK_TRACK_SIZE;
+		sys_info_block.disks[i].tracks = -1;
+	}
+	sys_info_block.term_units = USLOSS_TERM_UNITS;
+	sys_info_block.clock_tick_us = CLOCK_TICK_US;
+	wait_blocks = 0;
+	wait_wakeups = 0;
+	wait_queue_init(&sleep_queue, 1);
+	wait_queue_init(&disk_probe_queue, 0);
 
 	systemCallVec[SYS_SLEEP] = Sleep_handler;
 	systemCallVec[SYS_TERMREAD] = TermRead_handler;
@@ -130,10 +521,121 @@ void phase4_init(void) {
 	systemCallVec[SYS_DISKSIZE] = DiskSize_handler;
 	systemCallVec[SYS_DISKREAD] = DiskRead_handler;
 	systemCallVec[SYS_DISKWRITE] = DiskWrite_handler;
+	systemCallVec[SYS_DISKSTATS] = DiskStats_handler;
+	systemCallVec[SYS_DISKSETLIMIT] = DiskSetLimit_handler;
+	systemCallVec[SYS_DISKGETLIMIT] = DiskGetLimit_handler;
+	systemCallVec[SYS_DISKRESYNC] = DiskResync_handler;
+	systemCallVec[SYS_DISKTRACE] = DiskTrace_handler;
+	systemCallVec[SYS_KTRACE] = KTrace_handler;
+	systemCallVec[SYS_PROCIO] = ProcIO_handler;
+	systemCallVec[SYS_PROFILE] = Profile_handler;
+	systemCallVec[SYS_TERMCQCREATE] = TermCQCreate_handler;
+	systemCallVec[SYS_TERMCQRELEASE] = TermCQRelease_handler;
+	systemCallVec[SYS_TERMREADASYNC] = TermReadAsync_handler;
+	systemCallVec[SYS_TERMWRITEASYNC] = TermWriteAsync_handler;
+	systemCallVec[SYS_TERMCOMPLETE] = TermComplete_handler;
+	systemCallVec[SYS_BATCH] = Batch_handler;
+	systemCallVec[SYS_IO_SETUP] = IoSetup_handler;
+	systemCallVec[SYS_IO_ENTER] = IoEnter_handler;
+	systemCallVec[SYS_DISKCOPY] = DiskCopy_handler;
+	systemCallVec[SYS_DISKFILL] = DiskFill_handler;
+
+	// Phase 3 has already installed its handlers
+	phase3_spawn_handler = systemCallVec[SYS_SPAWN];
+	systemCallVec[SYS_SPAWN] = Spawn_handler;
+	phase3_terminate_handler = systemCallVec[SYS_TERMINATE];
+	systemCallVec[SYS_TERMINATE] = Terminate_handler;
+
+	memset(profile_table, 0, sizeof(profile_table));
+	profile_running = 0;
+	profile_ticks = 0;
+	phase2_clock_interrupt = USLOSS_IntVec[USLOSS_CLOCK_INT];
+	USLOSS_IntVec[USLOSS_CLOCK_INT] = profile_clock_interrupt;
+	memset(procs, 0, sizeof(procs));
+	spawn_depth = 0;
+	qos_last_refill = 0;
+	qos_enabled = 0;
+
+	memset(ra_cache, 0, sizeof(ra_cache));
+	memset(ra_streams, 0, sizeof(ra_streams));
+	memset(ra_node, 0, sizeof(ra_node));
+	memset(disk_unit_stats, 0, sizeof(disk_unit_stats));
+	memset(disk_trace_ring, 0, sizeof(disk_trace_ring));
+	disk_trace_total[0] = 0;
+	disk_trace_total[1] = 0;
+	disk_trace_ids[0] = 0;
+	disk_trace_ids[1] = 0;
+	memset(ktrace_ring, 0, sizeof(ktrace_ring));
+	memset(ktrace_total, 0, sizeof(ktrace_total));
+	ra_cache_next[0] = 0;
+	ra_cache_next[1] = 0;
+
+	for(int i=0; i<2; i++){
+		disk_read_queue[i] = NULL;
+		disk_write_queue[i] = NULL;
+		disk_batch_op[i] = READ;
+		disk_batch_count[i] = 0;
+		disk_head_track[i] = 0;
+		disk_stalled[i] = 0;
+	}
 
 	disk0_mutex_mailbox_num = MboxCreate(1,0);
 	disk1_mutex_mailbox_num = MboxCreate(1,0);
 
+	memset(mirror_dirty, 0, sizeof(mirror_dirty));
+	mirror_dirty_count[0] = 0;
+	mirror_dirty_count[1] = 0;
+	mirror_active_writes = 0;
+	mirror_resync_busy = 0;
+	mirror_resync_signalled = 0;
+	mirror_mutex_mailbox_num = MboxCreate(1,0);
+	disk_copy_mutex_mailbox_num = MboxCreate(1,0);
+	for(int i=0; i<DISK_FILL_BLOCKS; i++){
+		disk_fill_blocks[i].pattern = -1;
+		disk_fill_blocks[i].users = 0;
+	}
+	wait_queue_init(&disk_fill_queue, 0);
+	wait_queue_init(&mirror_drain_queue, 0);
+	wait_queue_init(&mirror_turn_queue, 0);
+	wait_queue_init(&mirror_resync_queue, 0);
+
+	memset(term_lines_in, 0, sizeof(term_lines_in));
+	memset(term_lines_dropped, 0, sizeof(term_lines_dropped));
+	memset(term_lines_out, 0, sizeof(term_lines_out));
+	sleep_wakeups = 0;
+	lock_waits = 0;
+	lock_wait_time = 0;
+	metrics_due = 0;
+	wait_queue_init(&metrics_queue, 0);
+
+	term_async_free = NULL;
+	for(int i=0; i<TERM_ASYNC_POOL; i++){
+		term_async_pool[i].next = term_async_free;
+		term_async_free = &term_async_pool[i];
+	}
+	for(int i=0; i<USLOSS_TERM_UNITS; i++){
+		term_async_reads[i] = NULL;
+		term_async_writes[i] = NULL;
+		term_async_writing[i] = NULL;
+	}
+	for(int i=0; i<TERM_CQ_MAX; i++){
+		term_cqs[i].mailbox_num = -1;
+		term_cqs[i].outstanding = 0;
+	}
+	term_async_mutex_mailbox_num = MboxCreate(1,0);
+	term_async_used = 0;
+
+	for(int i=0; i<IO_RING_MAX; i++){
+		io_rings[i].ring = NULL;
+		wait_queue_init(&io_rings[i].waiters, 0);
+	}
+	io_request_free_list = NULL;
+	for(int i=0; i<IO_RING_MAX*IO_RING_ENTRIES; i++){
+		io_request_pool[i].next = io_request_free_list;
+		io_request_free_list = &io_request_pool[i];
+	}
+	io_timeouts = NULL;
+
 	for (int i = 0; i < USLOSS_MAX_UNITS; i++) {
 		term_data td;
 		td.read_mb = MboxCreate(MAX_TERM_BUFFERS,MAXLINE+1);
@@ -146,12 +648,6 @@ void phase4_init(void) {
 	}
 	disk0_mutex_mailbox_num = MboxCreate(1,0);
 	disk1_mutex_mailbox_num = MboxCreate(1,0);
-
-	track_count0_mutex_mailbox_num = MboxCreate(1,0);	
-	track_count1_mutex_mailbox_num = MboxCreate(1,0);	
-	
-	track_list0_mutex_mailbox_num = MboxCreate(1,0);	
-	track_list1_mutex_mailbox_num = MboxCreate(1,0);	
 }
 
 /**
@@ -165,7 +661,8 @@ void phase4_start_service_processes(void) {
 	int unit0 = 0;
 	int unit1 = 1;
 
-	fork1("get_tracks", get_tracks, "", USLOSS_MIN_STACK, 1);
+	// Idle until a half of the mirrored unit goes out of date
+	fork1("mirror_daemon", mirror_daemon, "", USLOSS_MIN_STACK, MIRROR_RESYNC_PRIORITY);
 	fork1("sleep_daemon", sleep_daemon, "", USLOSS_MIN_STACK, 1);
 	fork1("term_daemon_0", term_daemon, "0", USLOSS_MIN_STACK, 1);
 	fork1("term_daemon_1", term_daemon, "1", USLOSS_MIN_STACK, 1);
@@ -173,7 +670,8 @@ void phase4_start_service_processes(void) {
 	fork1("term_daemon_3", term_daemon, "3", USLOSS_MIN_STACK, 1);
 	fork1("disk_daemon0", disk_daemon, (void*)(long)unit0, USLOSS_MIN_STACK, 1);
 	fork1("disk_daemon1", disk_daemon, (void*)(long)unit1, USLOSS_MIN_STACK, 1);
-
+	if(METRICS_TERM>=0)
+		fork1("metrics_daemon", metrics_daemon, "", USLOSS_MIN_STACK, 5);
 }
 
 /** 
@@ -189,8 +687,6 @@ void phase4_start_service_processes(void) {
 */
 
 void TermRead_handler(USLOSS_Sysargs *args) {
-	if (TRACE)
-		USLOSS_Console("TRACE: In TermRead handler\n");
 
 	char* buffer = (char*)(long) args->arg1;
 	int bufferSize = (int)(long) args->arg2;
@@ -209,14 +705,17 @@ void TermRead_handler(USLOSS_Sysargs *args) {
 	}
 
 	term_data* term_ptr = &terminals[termNum];
-	if (DEBUG) {
-		USLOSS_Console("DEBUG: Right before receiving message\n");
-		dumpProcesses();
-	}
 
+	KTRACE(KTRACE_TERM, KTRACE_TERM_READ, termNum, bufferSize);
+	int start = currentTime();
 	MboxRecv(term_ptr->read_mb, buffer, bufferSize);
 
 	int charsRead = strlen(buffer);
+	proc_io_counters* io = &proc_get(getpid())->io.term_read;
+	io->ops++;
+	io->bytes += charsRead;
+	io->queued_time += currentTime() - start;
+	KTRACE(KTRACE_TERM, KTRACE_TERM_READ_DONE, termNum, charsRead);
 	args->arg2 = (void*)(long) charsRead;
 	args->arg4 = 0;
 }
@@ -233,8 +732,6 @@ void TermRead_handler(USLOSS_Sysargs *args) {
  * 	arg4: -1 if illegal values were given as input; 0 otherwise
 */
 void TermWrite_handler(USLOSS_Sysargs *args) {
-	if (TRACE)
-		USLOSS_Console("TRACE: In TermWrite handler\n");
 
 	char* buffer = (char*)(long) args->arg1;
 	int bufferSize = (int)(long) args->arg2;
@@ -248,100 +745,398 @@ void TermWrite_handler(USLOSS_Sysargs *args) {
 
 	term_data* term_ptr = &terminals[termNum];
 	
+	KTRACE(KTRACE_TERM, KTRACE_TERM_WRITE, termNum, bufferSize);
+	int start = currentTime();
 	MboxSend(term_ptr->write_mb, buffer, bufferSize);
+	proc_io_counters* io = &proc_get(getpid())->io.term_write;
+	io->ops++;
+	io->bytes += bufferSize;
+	io->queued_time += currentTime() - start;
+	KTRACE(KTRACE_TERM, KTRACE_TERM_WRITE_DONE, termNum, bufferSize);
 
 	args->arg2 = (void*)(long) bufferSize;
 	args->arg4 = 0;
 }
 
 /** 
- * Queries the size of a given disk. It returns three values, all as out-parameters.
- * System Call: SYS_DISKSIZE
+ * Creates a completion queue for asynchronous terminal requests.
+ * System Call: SYS_TERMCQCREATE
+ * System Call Outputs:
+ *	arg1: the queue
+ * 	arg4: -1 if no queue is left; 0 otherwise
+*/
+void TermCQCreate_handler(USLOSS_Sysargs *args) {
+	term_async_lock();
+	int cq = 0;
+	while(cq<TERM_CQ_MAX && term_cqs[cq].mailbox_num>=0)
+		cq++;
+	if(cq<TERM_CQ_MAX){
+		term_cqs[cq].mailbox_num = MboxCreate(TERM_ASYNC_MAX, sizeof(term_completion));
+		term_cqs[cq].outstanding = 0;
+		term_cqs[cq].pid = getpid();
+		term_async_used = 1;
+	}
+	term_async_unlock();
+
+	if(cq==TERM_CQ_MAX || term_cqs[cq].mailbox_num<0){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+	args->arg1 = (void*)(long) cq;
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Frees a completion queue. Requests still waiting on it are dropped, and
+ * TermComplete on it fails from then on.
+ * System Call: SYS_TERMCQRELEASE
  * System Call Arguments:
- *	arg1: the disk to query
+ *	arg1: the queue
  * System Call Outputs:
- * 	arg1: size of a block, in bytes
- * 	arg2: number of blocks in track
- * 	arg3: number of tracks in the disk
- * 	arg4: -1 if illegal values were given as input; 0 otherwise
+ * 	arg4: -1 if the queue is not one the caller made; 0 otherwise
 */
-void DiskSize_handler(USLOSS_Sysargs *args) {
-	if(DEBUG)
-		USLOSS_Console("in disk size hanlder\n");	
-	int unit = (int)(long) args->arg1;
-	args->arg1 = (void*)(long)512;
-	args->arg2 = (void*)(long)16;
-	if(unit==0){
-		track_count_lock0();
-		int count = track_count0;
-		track_count_unlock0();
-		if(count>-1){
-			if(DEBUG)
-				USLOSS_Console("count available");
-			args->arg3 = (void*)(long)count;
-			return;
-		}
+void TermCQRelease_handler(USLOSS_Sysargs *args) {
+	int cq = (int)(long) args->arg1;
+
+	if(cq < 0 || cq >= TERM_CQ_MAX){
+		args->arg4 = (void*)(long) -1;
+		return;
 	}
-	else{
-		track_count_lock1();
-		int count = track_count1;
-		track_count_unlock1();
-		if(count>-1){
-			args->arg3 = (void*)(long)count;
-			return;
-		}
+
+	term_async_lock();
+	int mine = term_cqs[cq].mailbox_num>=0 && term_cqs[cq].pid==getpid();
+	if(mine)
+		term_cq_release(cq);
+	term_async_unlock();
+
+	args->arg4 = (void*)(long) (mine ? 0 : -1);
+}
+
+/** 
+ * Starts reading a line from a terminal and returns. A line that is already
+ * waiting completes the request at once; otherwise term_daemon hands the
+ * next line to it, ahead of any blocking TermRead.
+ * System Call: SYS_TERMREADASYNC
+ * System Call Arguments:
+ *	arg1: buffer pointer, which must stay valid until completion
+ * 	arg2: length of the buffer
+ * 	arg3: which terminal to read
+ * 	arg4: completion queue
+ * 	arg5: tag for the completion
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 1 if too many requests
+ * 	      are outstanding; 0 otherwise
+*/
+void TermReadAsync_handler(USLOSS_Sysargs *args) {
+	char* buffer = (char*)(long) args->arg1;
+	int bufferSize = (int)(long) args->arg2;
+	int termNum = (int)(long) args->arg3;
+	int cq = (int)(long) args->arg4;
+	int tag = (int)(long) args->arg5;
+
+	if(buffer==NULL || bufferSize <= 0 || bufferSize > MAXLINE ||
+			termNum < 0 || termNum >= USLOSS_TERM_UNITS ||
+			cq < 0 || cq >= TERM_CQ_MAX || term_cqs[cq].mailbox_num < 0){
+		args->arg4 = (void*)(long) -1;
+		return;
 	}
-		
 
-	int my_mailbox_num = MboxCreate(1,0);
-	
-	track_list_node new_node;
-	new_node.mailbox_num = my_mailbox_num;
-	new_node.next = NULL;
+	term_async_lock();
+	if(term_cqs[cq].mailbox_num < 0){
+		// Released since it was checked
+		term_async_unlock();
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+	term_async* req = term_async_alloc(cq);
+	if(req==NULL){
+		term_async_unlock();
+		args->arg4 = (void*)(long) 1;
+		return;
+	}
+	req->tag = tag;
+	req->operation = TERM_ASYNC_READ;
+	req->unit = termNum;
+	req->buffer = buffer;
+	req->size = bufferSize;
+	term_async_start(req);
+	term_async_unlock();
+
+	args->arg4 = (void*)(long) 0;
+}
 
-	if(unit==0){
-	
-		track_list_lock0();
+/** 
+ * Queues a line to be written to a terminal and returns. The line is
+ * copied; term_daemon writes it when no blocking TermWrite is waiting.
+ * System Call: SYS_TERMWRITEASYNC
+ * System Call Arguments:
+ *	arg1: buffer pointer
+ * 	arg2: length of the buffer
+ * 	arg3: which terminal to write to
+ * 	arg4: completion queue
+ * 	arg5: tag for the completion
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 1 if too many requests
+ * 	      are outstanding; 0 otherwise
+*/
+void TermWriteAsync_handler(USLOSS_Sysargs *args) {
+	char* buffer = (char*)(long) args->arg1;
+	int bufferSize = (int)(long) args->arg2;
+	int termNum = (int)(long) args->arg3;
+	int cq = (int)(long) args->arg4;
+	int tag = (int)(long) args->arg5;
 
-		if(track_list0==NULL){
-			track_list0 = &new_node;
-		}
-		else{
-			track_list_node* head = track_list0;
-			
-			new_node.next = head->next;
-			head->next = &new_node;
-		}
+	if(buffer==NULL || bufferSize <= 0 || bufferSize > MAXLINE ||
+			termNum < 0 || termNum >= USLOSS_TERM_UNITS ||
+			cq < 0 || cq >= TERM_CQ_MAX || term_cqs[cq].mailbox_num < 0){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
 
-		track_list_unlock0();
+	term_async_lock();
+	if(term_cqs[cq].mailbox_num < 0){
+		term_async_unlock();
+		args->arg4 = (void*)(long) -1;
+		return;
 	}
-	else{
-		track_list_lock1();
+	term_async* req = term_async_alloc(cq);
+	if(req==NULL){
+		term_async_unlock();
+		args->arg4 = (void*)(long) 1;
+		return;
+	}
+	req->tag = tag;
+	req->operation = TERM_ASYNC_WRITE;
+	req->unit = termNum;
+	req->buffer = NULL;
+	req->size = bufferSize;
+	memcpy(req->data, buffer, bufferSize);
+	req->data[bufferSize] = '\0';
+	term_async_start(req);
+	term_async_unlock();
+
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Takes the oldest completion off a terminal completion queue.
+ * System Call: SYS_TERMCOMPLETE
+ * System Call Arguments:
+ *	arg1: completion queue
+ *	arg2: pointer to a term_completion
+ *	arg3: nonzero to block until a request completes
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 1 if arg3 was 0 and
+ * 	      nothing has completed; 0 otherwise
+*/
+void TermComplete_handler(USLOSS_Sysargs *args) {
+	int cq = (int)(long) args->arg1;
+	term_completion* done = (term_completion*) args->arg2;
+	int wait = (int)(long) args->arg3;
+
+	if(cq < 0 || cq >= TERM_CQ_MAX || term_cqs[cq].mailbox_num < 0 || done==NULL){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	term_completion completion;
+	int received;
+	if(wait)
+		received = MboxRecv(term_cqs[cq].mailbox_num, &completion, sizeof(completion));
+	else
+		received = MboxCondRecv(term_cqs[cq].mailbox_num, &completion, sizeof(completion));
+	if(received<0){
+		// Either nothing has completed, or the queue was released
+		args->arg4 = (void*)(long) (wait || term_cqs[cq].mailbox_num<0 ? -1 : 1);
+		return;
+	}
+
+	term_async_lock();
+	term_cqs[cq].outstanding--;
+	term_async_unlock();
+	*done = completion;
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Runs several phase 4 system calls, in order, in one trap. Disk reads and
+ * writes next to each other in the batch that go to different physical
+ * units are queued together, so both units work at the same time.
+ * System Call: SYS_BATCH
+ * System Call Arguments:
+ *	arg1: array of USLOSS_Sysargs, each holding a phase 4 call's number
+ *	      and arguments; each gets that call's outputs
+ * 	arg2: number of entries, at most BATCH_MAX
+ * System Call Outputs:
+ *	arg1: number of entries run
+ * 	arg4: -1 if illegal values were given as input or an entry is not a
+ *	      phase 4 call (the batch stops there); 0 otherwise
+*/
+void Batch_handler(USLOSS_Sysargs *args) {
+	USLOSS_Sysargs* calls = (USLOSS_Sysargs*) args->arg1;
+	int count = (int)(long) args->arg2;
 
-		if(track_list1==NULL){
-			track_list1 = &new_node;
+	if(calls==NULL || count<0 || count>BATCH_MAX){
+		args->arg1 = (void*)(long) 0;
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	int ran = 0;
+	while(ran<count && batch_allowed(calls[ran].number)){
+		int run = batch_disk_run(&calls[ran], count-ran);
+		if(run>1){
+			batch_disk(&calls[ran], run);
+			ran += run;
 		}
 		else{
-			track_list_node* head = track_list1;
-			new_node.next = head->next;
-			head->next = &new_node;
+			systemCallVec[calls[ran].number](&calls[ran]);
+			ran++;
 		}
+	}
+
+	args->arg1 = (void*)(long) ran;
+	args->arg4 = (void*)(long) (ran==count ? 0 : -1);
+}
 
-		track_list_unlock1();
+/** 
+ * Registers a submission/completion ring for the calling process.
+ * System Call: SYS_IO_SETUP
+ * System Call Arguments:
+ *	arg1: pointer to the io_ring, which must stay valid until the process quits
+ * System Call Outputs:
+ *	arg1: id of the ring, for IoEnter
+ * 	arg4: -1 if illegal values were given as input or no ring is left; 0 otherwise
+*/
+void IoSetup_handler(USLOSS_Sysargs *args) {
+	io_ring* ring = (io_ring*) args->arg1;
+	if(ring==NULL){
+		args->arg4 = (void*)(long) -1;
+		return;
 	}
 
+	// Terminal requests go through the asynchronous terminal code
+	term_async_lock();
+	term_async_used = 1;
+	term_async_unlock();
+
+	ring->sq_head = 0;
+	ring->sq_tail = 0;
+	ring->cq_head = 0;
+	ring->cq_tail = 0;
+	unsigned int psr = wait_lock();
+	int id = 0;
+	while(id<IO_RING_MAX && io_rings[id].ring!=NULL)
+		id++;
+	if(id<IO_RING_MAX){
+		io_rings[id].ring = ring;
+		io_rings[id].pid = getpid();
+		io_rings[id].inflight = 0;
+		io_rings[id].want = 0;
+		io_rings[id].closing = 0;
+	}
+	wait_unlock(psr);
 
-	
-	// Recv on specified mailbox, so daemon can wake me up at the right time
-	if(DEBUG)
-		USLOSS_Console("Disk size blockig\n");
-	void* empty_message = "";
-	MboxRecv(my_mailbox_num, empty_message, 0);	
-	MboxRelease(my_mailbox_num);
-	if(DEBUG)
-		USLOSS_Console("DISk size unblocked\n");
-	int tracks = new_node.response;
-	args->arg3 = (void*)(long)tracks;	
+	if(id==IO_RING_MAX){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+	args->arg1 = (void*)(long) id;
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Starts the requests added to a ring's submission queue since the last
+ * call, in order, and optionally waits for completions. Takes no more
+ * entries than the completion queue can hold along with those in flight;
+ * the rest stay in the ring for a later call.
+ * System Call: SYS_IO_ENTER
+ * System Call Arguments:
+ *	arg1: ring id
+ * 	arg2: most entries to take
+ * 	arg3: completions to wait for, counting those not yet taken; the wait
+ *	      also ends once nothing is in flight
+ * System Call Outputs:
+ *	arg1: number of entries taken
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void IoEnter_handler(USLOSS_Sysargs *args) {
+	int id = (int)(long) args->arg1;
+	int to_submit = (int)(long) args->arg2;
+	int min_complete = (int)(long) args->arg3;
+
+	if(id<0 || id>=IO_RING_MAX || io_rings[id].ring==NULL || io_rings[id].pid!=getpid() ||
+			to_submit<0 || min_complete<0 || min_complete>IO_RING_ENTRIES){
+		args->arg1 = (void*)(long) 0;
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	io_ring_state* state = &io_rings[id];
+	io_ring* ring = state->ring;
+	int submitted = 0;
+	while(submitted<to_submit && ring->sq_head != __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE)){
+		unsigned int unreaped = ring->cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+		if(state->inflight + unreaped >= IO_RING_ENTRIES)
+			break;
+		io_sqe sqe = ring->sq[ring->sq_head % IO_RING_ENTRIES];
+		if(!io_submit(id, &sqe))
+			break;
+		__atomic_store_n(&ring->sq_head, ring->sq_head+1, __ATOMIC_RELEASE);
+		submitted++;
+	}
+
+	if(min_complete>0){
+		state->want = min_complete;
+		wait_on_unless(&state->waiters, 0, io_ring_ready, state);
+	}
+
+	args->arg1 = (void*)(long) submitted;
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Queries the size of a given disk. It returns three values, all as out-parameters.
+ * System Call: SYS_DISKSIZE
+ * System Call Arguments:
+ *	arg1: the disk to query
+ * System Call Outputs:
+ * 	arg1: size of a block, in bytes
+ * 	arg2: number of blocks in track
+ * 	arg3: number of tracks in the disk
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskSize_handler(USLOSS_Sysargs *args) {
+	int unit = (int)(long) args->arg1;
+	if(!disk_unit_valid(unit)){
+		args->arg4 = (void*)(long)-1;
+		return;
+	}
+	args->arg1 = (void*)(long)USLOSS_DISK_SECTOR_SIZE;
+	args->arg2 = (void*)(long)USLOSS_DISK_TRACK_SIZE;
+	if(unit==DISK_MIRROR_UNIT || unit==DISK_STRIPE_UNIT){
+		// The mirror is as big as the smaller half; the stripe set uses
+		// that much of each
+		int count = disk_wait_probe(0);
+		int count1 = disk_wait_probe(1);
+		if(count1 < count)
+			count = count1;
+		if(unit==DISK_STRIPE_UNIT)
+			count *= 2;
+		else if(count > MIRROR_MAX_TRACKS)
+			count = MIRROR_MAX_TRACKS;
+		args->arg3 = (void*)(long)count;
+		args->arg4 = (void*)(long)0;
+		return;
+	}
+
+	// Only blocks while the unit's daemon is still probing it at boot
+	int tracks = disk_wait_probe(unit);
+	disk_geometry* geometry = &sys_info_block.disks[unit];
+	args->arg1 = (void*)(long)geometry->sector_size;
+	args->arg2 = (void*)(long)geometry->sectors_per_track;
+	args->arg3 = (void*)(long)tracks;
+	args->arg4 = (void*)(long)0;
 }
 
 /** 
@@ -379,65 +1174,487 @@ void DiskWrite_handler(USLOSS_Sysargs *args) {
 }
 
 /** 
- * Pauses the current process for a specified number of seconds (The delay is approximate.)
- * System Call: SYS_SLEEP
+ * Writes one byte value to every byte of a range of sectors. The disk
+ * daemon writes each sector from a kernel block holding the pattern, and
+ * fills waiting to be written next to each other go as one transfer.
+ * System Call: SYS_DISKFILL
  * System Call Arguments:
- *	arg1: seconds
+ *	arg1: byte value to write, 0 to 255
+ * 	arg2: number of sectors to write
+ * 	arg3: starting track number
+ *	arg4: starting block number
+ *	arg5: which disk to access
  * System Call Outputs:
- *	arg4: -1 if illegal values were given as input; 0 otherwise
- */
-void Sleep_handler(USLOSS_Sysargs *args) {
-	// Add myself to queue
-	// Block me
-	int pid = getpid();
-	long seconds = (long)args->arg1;
-	long wake_up_time = time_counter + seconds*10;
-	
-	sleep_list_node new_node;
-	new_node.pid = pid;
-	new_node.wake_up_time = wake_up_time;
-	new_node.next = NULL;
-	
-	if(sleep_list==NULL){
-		sleep_list = &new_node;
-	}
-	else{
-		sleep_list_node* curr = sleep_list;
-		while(curr->next!=NULL && (curr->next->wake_up_time < new_node.wake_up_time)){
-			curr = curr->next;
-		}
-		new_node.next = curr->next;
-		curr->next = &new_node;
+ * 	arg1: 0 if transfer was successful; the disk status register otherwise
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskFill_handler(USLOSS_Sysargs *args) {
+	int pattern = (int)(long) args->arg1;
+	int sectors = (int)(long) args->arg2;
+	int track = (int)(long) args->arg3;
+	int first = (int)(long) args->arg4;
+	int unit = (int)(long) args->arg5;
+
+	if(!disk_unit_valid(unit) || pattern<0 || pattern>255 || sectors<0 ||
+			track<0 || first<0 || first>=16){
+		args->arg4 = (void*)(long) -1;
+		return;
 	}
-	blockMe(40);
+	KTRACE(KTRACE_DISK, KTRACE_DISK_WRITE, unit, track);
+	int status = disk_fill(unit, track, first, sectors, pattern);
+	disk_helper_done(args, WRITE, status);
+}
 
-	args->arg4 = 0;
+/** 
+ * Copies sectors from one disk region to another in the kernel, without
+ * passing them through user memory. Overlapping regions on one unit are
+ * copied as if through a temporary buffer.
+ * System Call: SYS_DISKCOPY
+ * System Call Arguments:
+ *	arg1: disk to copy from
+ * 	arg2: first sector to copy from, counting from track 0 block 0
+ * 	arg3: disk to copy to
+ *	arg4: first sector to copy to, counting from track 0 block 0
+ *	arg5: number of sectors to copy
+ * System Call Outputs:
+ * 	arg1: 0 if the copy was successful; the disk status register of the first failed transfer otherwise
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskCopy_handler(USLOSS_Sysargs *args) {
+	int src_unit = (int)(long) args->arg1;
+	int src = (int)(long) args->arg2;
+	int dst_unit = (int)(long) args->arg3;
+	int dst = (int)(long) args->arg4;
+	int sectors = (int)(long) args->arg5;
+
+	if(!disk_unit_valid(src_unit) || !disk_unit_valid(dst_unit) || src<0 || dst<0 || sectors<0){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+	int status = disk_copy(src_unit, src, dst_unit, dst, sectors);
+	KTRACE(KTRACE_DISK, KTRACE_DISK_DONE, dst_unit, status);
+	args->arg1 = (void*)(long) status;
+	args->arg4 = (void*)(long) 0;
 }
 
-int term_daemon(char* arg) {
-	int status;
-	int termNum = atoi(arg);
-	term_data* term_ptr = &terminals[termNum];
-	
-	char to_write[MAXLINE+1];
-	memset(to_write,0,MAXLINE+1);
-	
-	// Enabling recv and xmit interrupts for the terminals
-	USLOSS_DeviceOutput(USLOSS_TERM_DEV, termNum, (void*) 6);
+/** 
+ * Wraps phase 3's SYS_SPAWN handler to remember the priority of each new
+ * process, which the disk scheduler uses to order requests. The priority
+ * also applies while phase 3 is creating the child, which runs at once if
+ * it outranks its parent.
+ * System Call: SYS_SPAWN
+ * System Call Arguments:
+ *	arg4: priority
+ *	(the rest are passed through to phase 3)
+ * System Call Outputs:
+ *	arg1: pid of the new process
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void Spawn_handler(USLOSS_Sysargs *args) {
+	int priority = (int)(long) args->arg4;
+
+	int parent = getpid();
+	spawns[spawn_depth].parent = parent;
+	spawns[spawn_depth].priority = priority;
+	spawn_depth++;
+	phase3_spawn_handler(args);
+
+	// Spawns by other processes may have started meanwhile
+	int i = spawn_depth-1;
+	while(spawns[i].parent!=parent)
+		i--;
+	for(; i<spawn_depth-1; i++)
+		spawns[i] = spawns[i+1];
+	spawn_depth--;
+
+	int pid = (int)(long) args->arg1;
+	if((long) args->arg4==0 && pid>0){
+		proc_data* proc = proc_get(pid);
+		proc->priority = priority;
+	}
+}
 
-	while (1) {
-		waitDevice(USLOSS_TERM_DEV, termNum, &status);
-		//USLOSS_DeviceInput(USLOSS_TERM_DEV, termNum, &status);
-		
-		MboxCondRecv(term_ptr->write_mb, to_write, MAXLINE);
-		if (USLOSS_TERM_STAT_XMIT(status) == USLOSS_DEV_READY && strlen(to_write) > 0) {
-			terminal_lock(termNum);
+/** 
+ * Wraps phase 3's SYS_TERMINATE handler to wait for the process's io ring
+ * requests to finish and free its rings, and to print its I/O accounting
+ * first when built with PROC_IO_DUMP.
+ * System Call: SYS_TERMINATE
+ * System Call Arguments:
+ *	(passed through to phase 3)
+*/
+void Terminate_handler(USLOSS_Sysargs *args) {
+	io_ring_release(getpid());
+	term_cq_release_owned(getpid());
+	if(PROC_IO_DUMP)
+		proc_io_dump(getpid());
+	phase3_terminate_handler(args);
+}
 
-			termWriting(termNum, to_write);
-			memset(to_write,0,MAXLINE+1);
+/** 
+ * Copies the I/O accounting of a process into a caller-supplied proc_io
+ * struct. A process that has done nothing yet reads as all zeros.
+ * System Call: SYS_PROCIO
+ * System Call Arguments:
+ *	arg1: pid, or 0 for the caller
+ *	arg2: pointer to a proc_io struct
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void ProcIO_handler(USLOSS_Sysargs *args) {
+	int pid = (int)(long) args->arg1;
+	proc_io* io = (proc_io*) args->arg2;
 
-			terminal_unlock(termNum);
-		}
+	if(pid<0 || io==NULL){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+	if(pid==0)
+		pid = getpid();
+
+	proc_data* proc = proc_find(pid);
+	if(proc==NULL)
+		memset(io, 0, sizeof(proc_io));
+	else
+		*io = proc->io;
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Starts, stops or reads the clock-tick CPU profile. Starting clears the
+ * samples of any earlier run.
+ * System Call: SYS_PROFILE
+ * System Call Arguments:
+ *	arg1: PROFILE_START, PROFILE_STOP or PROFILE_DUMP
+ *	arg2: PROFILE_DUMP: pointer to an array of profile_sample
+ *	arg3: PROFILE_DUMP: number of entries the array holds
+ * System Call Outputs:
+ *	arg1: PROFILE_DUMP: number of processes copied
+ *	arg2: PROFILE_DUMP: ticks sampled in all
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void Profile_handler(USLOSS_Sysargs *args) {
+	int command = (int)(long) args->arg1;
+	profile_sample* samples = (profile_sample*) args->arg2;
+	int max = (int)(long) args->arg3;
+
+	if(command==PROFILE_START){
+		profile_running = 0;
+		memset(profile_table, 0, sizeof(profile_table));
+		profile_ticks = 0;
+		profile_running = 1;
+	}
+	else if(command==PROFILE_STOP){
+		profile_running = 0;
+	}
+	else if(command==PROFILE_DUMP && samples!=NULL && max>=0){
+		int count = 0;
+		for(int i=0; i<PROFILE_PIDS && count<max; i++){
+			if(profile_table[i].pid!=0)
+				samples[count++] = profile_table[i];
+		}
+		args->arg1 = (void*)(long) count;
+		args->arg2 = (void*)(long) profile_ticks;
+	}
+	else{
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Copies the statistics kept for a disk unit (request counts and read-ahead
+ * accuracy) into a caller-supplied disk_stats struct.
+ * System Call: SYS_DISKSTATS
+ * System Call Arguments:
+ *	arg1: which disk to query
+ *	arg2: pointer to a disk_stats struct
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskStats_handler(USLOSS_Sysargs *args) {
+	int unit = (int)(long) args->arg1;
+	disk_stats* stats = (disk_stats*) args->arg2;
+
+	if((unit!=0&&unit!=1) || stats==NULL){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	disk_lock(unit);
+	memcpy(stats, &disk_unit_stats[unit], sizeof(disk_stats));
+	disk_unlock(unit);
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Limits the disk bandwidth of a process. Each limit is enforced by a token
+ * bucket that refills every clock tick and holds up to DISK_QOS_BURST
+ * seconds' worth; requests of a process that has run out of tokens wait in
+ * the queue while others are served. A limit of 0 removes it.
+ * System Call: SYS_DISKSETLIMIT
+ * System Call Arguments:
+ *	arg1: pid of the process to limit
+ *	arg2: sectors per second
+ *	arg3: operations per second
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskSetLimit_handler(USLOSS_Sysargs *args) {
+	int pid = (int)(long) args->arg1;
+	int sector_rate = (int)(long) args->arg2;
+	int op_rate = (int)(long) args->arg3;
+
+	if(pid<=0 || sector_rate<0 || op_rate<0){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	disk_lock(0);
+	disk_lock(1);
+	proc_data* proc = proc_get(pid);
+	proc->sector_rate = sector_rate;
+	proc->op_rate = op_rate;
+	unsigned int psr = wait_lock();
+	proc->sector_credit = sector_rate*1000L*DISK_QOS_BURST;
+	proc->op_credit = op_rate*1000L*DISK_QOS_BURST;
+	if(!qos_enabled){
+		qos_last_refill = currentTime();
+		qos_enabled = 1;
+	}
+	wait_unlock(psr);
+	disk_unlock(1);
+	disk_unlock(0);
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Reads the disk limits of a process and how long its requests have been
+ * held back by them.
+ * System Call: SYS_DISKGETLIMIT
+ * System Call Arguments:
+ *	arg1: pid of the process
+ *	arg2: pointer to a disk_qos struct
+ * System Call Outputs:
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskGetLimit_handler(USLOSS_Sysargs *args) {
+	int pid = (int)(long) args->arg1;
+	disk_qos* qos = (disk_qos*) args->arg2;
+
+	if(pid<=0 || qos==NULL){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	memset(qos, 0, sizeof(disk_qos));
+	disk_lock(0);
+	disk_lock(1);
+	proc_data* proc = proc_find(pid);
+	if(proc!=NULL){
+		qos->sector_rate = proc->sector_rate;
+		qos->op_rate = proc->op_rate;
+		qos->throttled_time = proc->throttled_time;
+		qos->throttled_ops = proc->throttled_ops;
+	}
+	disk_unlock(1);
+	disk_unlock(0);
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Marks one half of the mirrored unit as entirely out of date, e.g. after
+ * its disk has been replaced, and has mirror_daemon copy it back from the
+ * other half in the background. Reads avoid out of date tracks until then.
+ * With unit -1, only reports progress.
+ * System Call: SYS_DISKRESYNC
+ * System Call Arguments:
+ *	arg1: unit to resync, or -1
+ * System Call Outputs:
+ *	arg2: tracks of unit 0 still out of date
+ *	arg3: tracks of unit 1 still out of date
+ * 	arg4: -1 if illegal values were given as input, or the other half is
+ *	      itself out of date; 0 otherwise
+*/
+void DiskResync_handler(USLOSS_Sysargs *args) {
+	int unit = (int)(long) args->arg1;
+
+	if(unit!=0 && unit!=1 && unit!=-1){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	int result = 0;
+	if(unit!=-1){
+		USLOSS_Sysargs size_args;
+		size_args.arg1 = (void*)(long)DISK_MIRROR_UNIT;
+		DiskSize_handler(&size_args);
+		int tracks = (int)(long) size_args.arg3;
+
+		mirror_lock();
+		if(mirror_dirty_count[1-unit]>0)
+			result = -1;
+		else
+			mirror_mark_dirty(unit, 0, tracks-1);
+		mirror_unlock();
+	}
+
+	mirror_lock();
+	args->arg2 = (void*)(long) mirror_dirty_count[0];
+	args->arg3 = (void*)(long) mirror_dirty_count[1];
+	mirror_unlock();
+	args->arg4 = (void*)(long) result;
+}
+
+/** 
+ * Copies the newest records of a disk unit's trace, oldest first. The
+ * trace keeps the last DISK_TRACE_RECORDS events of the unit.
+ * System Call: SYS_DISKTRACE
+ * System Call Arguments:
+ *	arg1: unit
+ *	arg2: pointer to an array of disk_trace_record
+ *	arg3: number of records the array holds
+ * System Call Outputs:
+ *	arg1: number of records copied
+ *	arg2: number of older records that have been overwritten
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void DiskTrace_handler(USLOSS_Sysargs *args) {
+	int unit = (int)(long) args->arg1;
+	disk_trace_record* records = (disk_trace_record*) args->arg2;
+	int max = (int)(long) args->arg3;
+
+	if((unit!=0&&unit!=1) || records==NULL || max<0){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	disk_lock(unit);
+	int total = disk_trace_total[unit];
+	int count = total < DISK_TRACE_RECORDS ? total : DISK_TRACE_RECORDS;
+	if(count > max)
+		count = max;
+	for(int i=0; i<count; i++)
+		records[i] = disk_trace_ring[unit][(total-count+i) % DISK_TRACE_RECORDS];
+	disk_unlock(unit);
+
+	args->arg1 = (void*)(long) count;
+	args->arg2 = (void*)(long) (total-count);
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Copies the newest records of a subsystem's kernel trace, oldest first.
+ * Records that were being overwritten during the copy are left out and
+ * counted as lost.
+ * System Call: SYS_KTRACE
+ * System Call Arguments:
+ *	arg1: subsystem, KTRACE_SLEEP, KTRACE_DISK or KTRACE_TERM
+ *	arg2: pointer to an array of ktrace_record
+ *	arg3: number of records the array holds
+ * System Call Outputs:
+ *	arg1: number of records copied
+ *	arg2: number of older records that are no longer available
+ * 	arg4: -1 if illegal values were given as input; 0 otherwise
+*/
+void KTrace_handler(USLOSS_Sysargs *args) {
+	int subsystem = (int)(long) args->arg1;
+	ktrace_record* records = (ktrace_record*) args->arg2;
+	int max = (int)(long) args->arg3;
+
+	if(subsystem<0 || subsystem>=KTRACE_SUBSYSTEMS || records==NULL || max<0){
+		args->arg4 = (void*)(long) -1;
+		return;
+	}
+
+	int total = __atomic_load_n(&ktrace_total[subsystem], __ATOMIC_ACQUIRE);
+	int first = total < KTRACE_RECORDS ? 0 : total-KTRACE_RECORDS;
+	if(total-first > max)
+		first = total-max;
+	int count = 0;
+	for(int slot=first; slot<total; slot++){
+		ktrace_record* rec = &ktrace_ring[subsystem][slot % KTRACE_RECORDS];
+		records[count] = *rec;
+		// Still being written, or already reused for a newer event
+		if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != slot+1 || records[count].seq != slot+1)
+			continue;
+		count++;
+	}
+
+	args->arg1 = (void*)(long) count;
+	args->arg2 = (void*)(long) (total-count);
+	args->arg4 = (void*)(long) 0;
+}
+
+/** 
+ * Pauses the current process for a specified number of seconds (The delay is approximate.)
+ * System Call: SYS_SLEEP
+ * System Call Arguments:
+ *	arg1: seconds
+ * System Call Outputs:
+ *	arg4: -1 if illegal values were given as input; 0 otherwise
+ */
+void Sleep_handler(USLOSS_Sysargs *args) {
+	// Add myself to queue
+	// Block me
+	int pid = getpid();
+	long seconds = (long)args->arg1;
+	long wake_up_time = time_counter + seconds*(1000000/CLOCK_TICK_US);
+	KTRACE(KTRACE_SLEEP, KTRACE_SLEEP_ENTER, seconds, wake_up_time);
+	int start = currentTime();
+	
+	wait_on(&sleep_queue, wake_up_time);
+	KTRACE(KTRACE_SLEEP, KTRACE_SLEEP_WAKE, pid, time_counter);
+	KTRACE(KTRACE_SLEEP, KTRACE_SLEEP_RETURN, seconds, time_counter - wake_up_time);
+	proc_io_counters* io = &proc_get(pid)->io.sleep;
+	io->ops++;
+	io->queued_time += currentTime() - start;
+
+	args->arg4 = 0;
+}
+
+int term_daemon(char* arg) {
+	int status;
+	int termNum = atoi(arg);
+	term_data* term_ptr = &terminals[termNum];
+	
+	char to_write[MAXLINE+1];
+	memset(to_write,0,MAXLINE+1);
+	
+	// Enabling recv and xmit interrupts for the terminals
+	USLOSS_DeviceOutput(USLOSS_TERM_DEV, termNum, (void*) 6);
+
+	while (1) {
+		waitDevice(USLOSS_TERM_DEV, termNum, &status);
+		//USLOSS_DeviceInput(USLOSS_TERM_DEV, termNum, &status);
+		
+		if (term_async_writing[termNum] == NULL)
+			MboxCondRecv(term_ptr->write_mb, to_write, MAXLINE);
+		// TermWriteAsync lines go out when no TermWrite is waiting
+		if (strlen(to_write) == 0 && term_async_writing[termNum] == NULL && term_async_used) {
+			term_async_lock();
+			term_async* async_write = term_async_pop(&term_async_writes[termNum]);
+			term_async_writing[termNum] = async_write;
+			term_async_unlock();
+			if (async_write != NULL)
+				strcpy(to_write, async_write->data);
+		}
+		if (USLOSS_TERM_STAT_XMIT(status) == USLOSS_DEV_READY && strlen(to_write) > 0) {
+			terminal_lock(termNum);
+
+			termWriting(termNum, to_write);
+			memset(to_write,0,MAXLINE+1);
+
+			terminal_unlock(termNum);
+
+			if (term_async_writing[termNum] != NULL) {
+				term_async_lock();
+				term_async* async_write = term_async_writing[termNum];
+				term_async_writing[termNum] = NULL;
+				term_async_finish(async_write, async_write->size);
+				term_async_unlock();
+			}
+		}
 
 		if (USLOSS_TERM_STAT_RECV(status) == USLOSS_DEV_BUSY) {
 			terminal_lock(termNum);
@@ -471,6 +1688,8 @@ void termWriting(int termNum, char* to_write) {
 	
 	ctrl = USLOSS_TERM_CTRL_CHAR(7,*w);
 	USLOSS_DeviceOutput(USLOSS_TERM_DEV, termNum, (void*) ctrl);
+	KTRACE(KTRACE_TERM, KTRACE_TERM_LINE_OUT, termNum, (int)(w - to_write) + 1);
+	term_lines_out[termNum]++;
 }
 
 void termReading(int termNum) {
@@ -480,7 +1699,247 @@ void termReading(int termNum) {
 	strcpy(tempBuf, term_ptr->buffer);
 	memset(term_ptr->buffer, 0, MAXLINE+1);
 
-	MboxCondSend(term_ptr->read_mb, tempBuf, strlen(tempBuf));
+	// A waiting TermReadAsync gets the line before any blocking TermRead
+	if(term_async_used){
+		term_async_lock();
+		term_async* req = term_async_pop(&term_async_reads[termNum]);
+		if(req!=NULL)
+			term_async_finish(req, term_async_copy(req, tempBuf));
+		term_async_unlock();
+		if(req!=NULL){
+			term_lines_in[termNum]++;
+			return;
+		}
+	}
+
+	if(MboxCondSend(term_ptr->read_mb, tempBuf, strlen(tempBuf)) != 0){
+		KTRACE(KTRACE_TERM, KTRACE_TERM_LINE_DROP, termNum, strlen(tempBuf));
+		term_lines_dropped[termNum]++;
+	}
+	else{
+		KTRACE(KTRACE_TERM, KTRACE_TERM_LINE_IN, termNum, strlen(tempBuf));
+		term_lines_in[termNum]++;
+	}
+}
+
+/**
+* Takes a request from the pool for completion queue cq. Caller holds the
+* async lock.
+*
+* Returns: the request, or NULL if the pool is empty or cq already has
+* TERM_ASYNC_MAX requests outstanding
+*/
+term_async* term_async_alloc(int cq){
+	if(term_async_free==NULL || (cq>=0 && term_cqs[cq].outstanding>=TERM_ASYNC_MAX))
+		return NULL;
+	term_async* req = term_async_free;
+	term_async_free = req->next;
+	req->cq = cq;
+	req->ring = -1;
+	req->next = NULL;
+	if(cq>=0)
+		term_cqs[cq].outstanding++;
+	return req;
+}
+
+/**
+* Starts a request that has been filled in: a read takes a line that is
+* already waiting, or else waits for term_daemon; a write is queued for
+* term_daemon. Caller holds the async lock, so a line cannot slip into
+* read_mb between checking it and queueing the read.
+*/
+void term_async_start(term_async* req){
+	if(req->operation==TERM_ASYNC_WRITE){
+		term_async_append(&term_async_writes[req->unit], req);
+		return;
+	}
+	// libphase2 returns the length of the line, or a negative value if
+	// none is waiting
+	char line[MAXLINE+1];
+	int length = MboxCondRecv(terminals[req->unit].read_mb, line, MAXLINE);
+	if(length>=0){
+		line[length] = '\0';
+		term_async_finish(req, term_async_copy(req, line));
+	}
+	else
+		term_async_append(&term_async_reads[req->unit], req);
+}
+
+/**
+* Adds a request to the end of a terminal's queue. Caller holds the async
+* lock.
+*/
+void term_async_append(term_async** queue, term_async* req){
+	while(*queue!=NULL)
+		queue = &(*queue)->next;
+	req->next = NULL;
+	*queue = req;
+}
+
+/**
+* Removes the oldest request from a terminal's queue, or returns NULL if it
+* is empty. Caller holds the async lock.
+*/
+term_async* term_async_pop(term_async** queue){
+	term_async* req = *queue;
+	if(req!=NULL)
+		*queue = req->next;
+	return req;
+}
+
+/**
+* Copies a line into a read request's buffer, as much as fits, and
+* terminates it if there is room.
+*
+* Returns: the number of characters copied
+*/
+int term_async_copy(term_async* req, char* line){
+	int count = strlen(line);
+	if(count > req->size)
+		count = req->size;
+	memcpy(req->buffer, line, count);
+	if(count < req->size)
+		req->buffer[count] = '\0';
+	return count;
+}
+
+/**
+* Posts a request's completion, to its queue or io ring, and returns it to
+* the pool. Both have a slot for every outstanding request, so this never
+* blocks. Caller holds the async lock.
+*/
+void term_async_finish(term_async* req, int count){
+	if(req->cq<0 && req->ring<0){
+		// Cancelled while term_daemon was writing it
+		req->next = term_async_free;
+		term_async_free = req;
+		return;
+	}
+	if(req->ring>=0){
+		io_post(req->ring, req->user_data, count);
+		req->next = term_async_free;
+		term_async_free = req;
+		return;
+	}
+
+	term_completion completion;
+	completion.tag = req->tag;
+	completion.operation = req->operation;
+	completion.unit = req->unit;
+	completion.count = count;
+	MboxCondSend(term_cqs[req->cq].mailbox_num, &completion, sizeof(completion));
+
+	req->next = term_async_free;
+	term_async_free = req;
+}
+
+/**
+* Withdraws the requests of completion queue cq, or of io ring ring, from
+* every terminal (pass -1 for the other). Waiting ones go back to the pool,
+* so a read can no longer write to its buffer. A write term_daemon is busy
+* with is marked cancelled and freed when it is done. An io ring gets a
+* -1 completion for each, so nothing is left in flight on it. Caller holds
+* the async lock.
+*/
+void term_async_cancel(int cq, int ring){
+	for(int unit=0; unit<USLOSS_TERM_UNITS; unit++){
+		term_async** queues[2] = { &term_async_reads[unit], &term_async_writes[unit] };
+		for(int i=0; i<2; i++){
+			term_async** link = queues[i];
+			while(*link!=NULL){
+				term_async* req = *link;
+				if((cq>=0 && req->cq==cq) || (ring>=0 && req->ring==ring)){
+					*link = req->next;
+					if(req->ring>=0)
+						io_post(req->ring, req->user_data, -1);
+					req->next = term_async_free;
+					term_async_free = req;
+				}
+				else
+					link = &req->next;
+			}
+		}
+
+		term_async* req = term_async_writing[unit];
+		if(req!=NULL && ((cq>=0 && req->cq==cq) || (ring>=0 && req->ring==ring))){
+			if(req->ring>=0)
+				io_post(req->ring, req->user_data, -1);
+			req->cq = -1;
+			req->ring = -1;
+		}
+	}
+}
+
+/**
+* Frees completion queue cq, dropping the requests still waiting on it.
+* Caller holds the async lock.
+*/
+void term_cq_release(int cq){
+	term_async_cancel(cq, -1);
+	MboxRelease(term_cqs[cq].mailbox_num);
+	term_cqs[cq].mailbox_num = -1;
+	term_cqs[cq].outstanding = 0;
+}
+
+/**
+* Frees the completion queues of a process that is quitting
+*/
+void term_cq_release_owned(int pid){
+	term_async_lock();
+	for(int cq=0; cq<TERM_CQ_MAX; cq++)
+		if(term_cqs[cq].mailbox_num>=0 && term_cqs[cq].pid==pid)
+			term_cq_release(cq);
+	term_async_unlock();
+}
+
+/**
+* Writes a snapshot of the disk, terminal, sleep and lock counters to
+* METRICS_TERM each time sleep_daemon says METRICS_INTERVAL ticks have
+* passed. Lines go through term_daemon like TermWrite's, so they queue
+* behind whatever else is being written to that terminal.
+*/
+int metrics_daemon(char* arg){
+	char line[MAXLINE+1];
+	while(1){
+		wait_on_unless(&metrics_queue, 0, wait_flag_set, &metrics_due);
+		metrics_due = 0;
+
+		for(int unit=0; unit<2; unit++){
+			disk_stats* stats = &disk_unit_stats[unit];
+			int queued = 0;
+			disk_lock(unit);
+			for(disk_list_node* node=disk_read_queue[unit]; node!=NULL; node=node->next)
+				queued++;
+			for(disk_list_node* node=disk_write_queue[unit]; node!=NULL; node=node->next)
+				queued++;
+			disk_unlock(unit);
+			snprintf(line, sizeof(line), "m %ld disk%d r %d w %d rlat %ld wlat %ld q %d ra %d\n",
+				time_counter, unit, stats->reads, stats->writes,
+				stats->reads ? stats->read_latency_total/stats->reads : 0,
+				stats->writes ? stats->write_latency_total/stats->writes : 0,
+				queued, stats->ra_cache_hits);
+			metrics_send(METRICS_TERM, line);
+		}
+		for(int term=0; term<USLOSS_TERM_UNITS; term++){
+			snprintf(line, sizeof(line), "m %ld term%d in %d drop %d out %d\n",
+				time_counter, term, term_lines_in[term], term_lines_dropped[term], term_lines_out[term]);
+			metrics_send(METRICS_TERM, line);
+		}
+		snprintf(line, sizeof(line), "m %ld sleep %d woken %d lockwait %d %ldus\n",
+			time_counter, sleep_queue.waiting, sleep_wakeups, lock_waits, lock_wait_time);
+		metrics_send(METRICS_TERM, line);
+		snprintf(line, sizeof(line), "m %ld wait blocked %d woken %d\n",
+			time_counter, wait_blocks, wait_wakeups);
+		metrics_send(METRICS_TERM, line);
+	}
+	return 0;
+}
+
+/**
+* Queues a line for a terminal the same way TermWrite does
+*/
+void metrics_send(int termNum, char* line){
+	MboxSend(terminals[termNum].write_mb, line, strlen(line));
 }
 
 int sleep_daemon(char* arg){
@@ -488,11 +1947,13 @@ int sleep_daemon(char* arg){
 	while(1){
 		waitDevice(USLOSS_CLOCK_DEV, 0, &status);
 		time_counter++;
-		// check queue
-		while(sleep_list!=NULL && sleep_list->wake_up_time<=time_counter){
-			int pid = sleep_list->pid;
-			sleep_list = sleep_list->next; 
-			unblockProc(pid);	
+		// wake everyone whose time has come
+		sleep_wakeups += wake_until(&sleep_queue, time_counter, 0);
+		io_timeout_expire(time_counter);
+		disk_qos_refill();
+		if(METRICS_TERM>=0 && time_counter % METRICS_INTERVAL == 0){
+			metrics_due = 1;
+			wake_all(&metrics_queue, 0);
 		}
 	}
 	return 0;
@@ -501,261 +1962,1032 @@ int sleep_daemon(char* arg){
 void disk_helper(USLOSS_Sysargs* args, int operation){
 
 	// Access arguments
+	char* buffer = args->arg1;
 	int sectors_num = (int)(long) args->arg2;
 	int track = (int)(long) args->arg3;	
 	int start_block = (int)(long) args->arg4;
-	int my_mailbox_num = MboxCreate(1,0);
 	int unit = (int)(long) args->arg5;
 	
 	// Validate args
-	if((unit!=0&&unit!=1)|| start_block<0 || start_block>16){
+	if(!disk_args_valid(args)){
 		args->arg4 = -1;
 		return;
 	}
 
-	// Create node for disk queue
+	KTRACE(KTRACE_DISK, operation==READ ? KTRACE_DISK_READ : KTRACE_DISK_WRITE, unit, track);
+	int status = disk_unit_io(unit, operation, buffer, track, start_block, sectors_num);
+	disk_helper_done(args, operation, status);
+}
+
+/**
+* Performs a read or write on any unit, physical or logical, and blocks
+* until it is done.
+*
+* Returns: 0 if the transfer was successful; the disk status register otherwise
+*/
+int disk_unit_io(int unit, int operation, char* buffer, int track, int start_block, int sectors_num){
+	if(unit==DISK_MIRROR_UNIT && operation==READ)
+		return mirror_read(buffer, track, start_block, sectors_num);
+	else if(unit==DISK_MIRROR_UNIT)
+		return mirror_write(buffer, track, start_block, sectors_num);
+	else if(unit==DISK_STRIPE_UNIT)
+		return stripe_io(operation, buffer, track, start_block, sectors_num);
+	return disk_io(unit, operation, buffer, track, start_block, sectors_num);
+}
+
+/**
+* Returns 1 if the arguments of a DiskRead or DiskWrite are legal
+*/
+int disk_args_valid(USLOSS_Sysargs* args){
+	int start_block = (int)(long) args->arg4;
+	int unit = (int)(long) args->arg5;
+	return disk_unit_valid(unit) && start_block>=0 && start_block<=16;
+}
+
+/**
+* Returns 1 for the physical units and the logical ones built on them
+*/
+int disk_unit_valid(int unit){
+	return unit==0 || unit==1 || unit==DISK_MIRROR_UNIT || unit==DISK_STRIPE_UNIT;
+}
+
+/**
+* Returns the number of sectors on a valid unit, physical or logical, as
+* DiskSize reports it
+*/
+int disk_unit_sectors(int unit){
+	USLOSS_Sysargs size_args;
+	size_args.arg1 = (void*)(long) unit;
+	DiskSize_handler(&size_args);
+	return (int)(long) size_args.arg3 * USLOSS_DISK_TRACK_SIZE;
+}
+
+/**
+* Accounts a finished DiskRead or DiskWrite and fills in its outputs
+*/
+void disk_helper_done(USLOSS_Sysargs* args, int operation, int status){
+	int sectors_num = (int)(long) args->arg2;
+	int unit = (int)(long) args->arg5;
+
+	//Operation is complete
+	KTRACE(KTRACE_DISK, KTRACE_DISK_DONE, unit, status);
+	disk_account(getpid(), operation, sectors_num);
+	args->arg1 = (void*)(long)status;
+	args->arg4 = (void*)(long)0;
+}
+
+/**
+* Performs a read or write on one physical unit and blocks until it is done.
+*
+* Returns: 0 if the transfer was successful; the disk status register otherwise
+*/
+int disk_io(int unit, int operation, char* buffer, int track, int start_block, int sectors_num){
+	disk_done done;
+	disk_done_init(&done, 0);
 	disk_list_node new_node;
-	new_node.pid = getpid();
-	new_node.started = 0;
-	new_node.track = track;
-	new_node.mailbox_num = my_mailbox_num;
-	new_node.buffer = args->arg1;
-	new_node.sectors = sectors_num;
-	new_node.sectors_done = 0;
-	new_node.start_block = start_block;
-	new_node.operation = operation;
-	new_node.response_status = 0;
-	new_node.next = NULL;
-
-	if(unit==0){
-	
-		disk_lock0();
-		if(disk_list0==NULL){
-
-			// No one on queue (disk daemon idle)
-			
-			disk_list0 = &new_node;
-			disk_unlock0();
-			
-			// Need to wait until track count is done being set, so the
-			// process getting track count doesn't "steal" this operation
-			// we are sending
-			wait_get_tracks(unit);
-			
-			// Send dummy operation to wake up idle daemon
-			int num=0;
-			USLOSS_DeviceRequest req;
- 			req.opr = USLOSS_DISK_TRACKS;
-			req.reg1 = (void*)&num;
-			USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
+	if(!disk_io_start(unit, operation, buffer, track, start_block, sectors_num, &new_node, &done))
+		return 0;
+
+	// Daemon wakes me up once the operation is complete
+	wait_on_unless(&done.waiters, 0, disk_done_ready, &done);
+	proc_io_disk(&new_node);
+	return new_node.response_status;
+}
+
+/**
+* Starts a read or write on one physical unit: queues node for it, counted
+* in done, unless the read-ahead cache already has the data.
+*
+* Returns: 1 if node was queued and is to be waited for through done; 0 if
+* the transfer was served, successfully, on the spot
+*/
+int disk_io_start(int unit, int operation, char* buffer, int track, int start_block, int sectors_num, disk_list_node* node, disk_done* done){
+	// Sequential read detection; a full hit in the read-ahead cache
+	// never touches the disk queue
+	int prefetch = 0;
+	if(operation==READ){
+		ra_stream* stream = ra_get_stream(unit);
+		int lba = track*16 + start_block;
+		int sequential = (stream->next_lba == lba);
+		stream->next_lba = lba + sectors_num;
+
+		disk_lock(unit);
+		int hit = ra_cache_read(unit, lba, sectors_num, buffer);
+		if(hit){
+			disk_unit_stats[unit].reads++;
+			disk_list_node hit_node;
+			disk_node_init(&hit_node, READ, buffer, track, start_block, sectors_num, NULL);
+			hit_node.id = ++disk_trace_ids[unit];
+			disk_trace(unit, DISK_TRACE_CACHE_HIT, &hit_node, sectors_num);
+		}
+		disk_unlock(unit);
+		if(hit)
+			return 0;
+
+		if(sequential){
+			// Grow the window each time the stream runs past the cache
+			if(stream->window < RA_MIN_WINDOW)
+				stream->window = RA_MIN_WINDOW;
+			else if(stream->window < RA_MAX_WINDOW)
+				stream->window *= 2;
+			prefetch = stream->window;
+
+			// Never prefetch past the end of the disk
+			int disk_sectors = disk_track_count(unit)*16;
+			if(lba + sectors_num + prefetch > disk_sectors)
+				prefetch = disk_sectors - (lba + sectors_num);
+			if(prefetch < 0)
+				prefetch = 0;
+			disk_unit_stats[unit].ra_window = stream->window;
 		}
 		else{
-			disk_list_node* curr = disk_list0;
-			if(new_node.track < curr->track){
-				// Inserting value that is less than head of list, put in second part of list
-				// Iterate to end of front part of list
-				while(curr->next!=NULL && curr->track <= curr->next->track){
-					curr = curr->next;
-				}
-				// Now can just insert like normal
-				while(curr->next!=NULL && (curr->next->track < new_node.track)){
-					curr = curr->next;
-				}
-				new_node.next = curr->next;
-				curr->next = &new_node;
-			}
+			// Random access, shrink the window
+			stream->window /= 2;
+		}
+	}
+	// Create node for disk queue
+	disk_node_init(node, operation, buffer, track, start_block, sectors_num, done);
+	node->prefetch = prefetch;
+	unsigned int psr = wait_lock();
+	done->pending++;
+	wait_unlock(psr);
+	disk_submit(unit, node);
+	return 1;
+}
+
+/**
+* Returns 1 if a system call may be part of a batch: any phase 4 call
+* other than SYS_BATCH itself
+*/
+int batch_allowed(int number){
+	switch(number){
+	case SYS_SLEEP:
+	case SYS_TERMREAD:
+	case SYS_TERMWRITE:
+	case SYS_DISKSIZE:
+	case SYS_DISKREAD:
+	case SYS_DISKWRITE:
+	case SYS_DISKCOPY:
+	case SYS_DISKFILL:
+	case SYS_TERMCQRELEASE:
+		return 1;
+	}
+	return number>=SYS_DISKSTATS && number<=SYS_TERMCOMPLETE;
+}
+
+/**
+* Counts the legal DiskRead/DiskWrite entries at the start of a batch that
+* go to physical units, stopping before the first one whose unit is
+* already used, as it has to wait for the one before it.
+*
+* Returns: the number of entries that can run together
+*/
+int batch_disk_run(USLOSS_Sysargs* calls, int count){
+	int used[2] = {0, 0};
+	int run = 0;
+	while(run<count){
+		USLOSS_Sysargs* call = &calls[run];
+		int unit = (int)(long) call->arg5;
+		if((call->number!=SYS_DISKREAD && call->number!=SYS_DISKWRITE)
+				|| (unit!=0 && unit!=1) || !disk_args_valid(call) || used[unit])
+			break;
+		used[unit] = 1;
+		run++;
+	}
+	return run;
+}
+
+/**
+* Runs DiskRead/DiskWrite entries on different physical units at the same
+* time, as picked by batch_disk_run
+*/
+void batch_disk(USLOSS_Sysargs* calls, int count){
+	disk_done done;
+	disk_done_init(&done, 0);
+	disk_list_node nodes[2];
+	int queued[2];
+	for(int i=0; i<count; i++){
+		USLOSS_Sysargs* call = &calls[i];
+		int operation = call->number==SYS_DISKREAD ? READ : WRITE;
+		int unit = (int)(long) call->arg5;
+		int track = (int)(long) call->arg3;
+		KTRACE(KTRACE_DISK, operation==READ ? KTRACE_DISK_READ : KTRACE_DISK_WRITE, unit, track);
+		queued[i] = disk_io_start(unit, operation, call->arg1, track, (int)(long) call->arg4,
+			(int)(long) call->arg2, &nodes[i], &done);
+	}
+	wait_on_unless(&done.waiters, 0, disk_done_ready, &done);
+
+	for(int i=0; i<count; i++){
+		int status = 0;
+		if(queued[i]){
+			proc_io_disk(&nodes[i]);
+			status = nodes[i].response_status;
+		}
+		disk_helper_done(&calls[i], calls[i].number==SYS_DISKREAD ? READ : WRITE, status);
+	}
+}
+
+/**
+* Copies sectors between disk regions through the kernel copy buffers,
+* DISK_COPY_CHUNK at a time. Between physical units the read of each chunk
+* is queued along with the write of the one before it, so with different
+* units both daemons work at once; the mirrored and striped units already
+* use both disks, so they go one transfer at a time. Callers take turns
+* with the buffers. A region running past the end of its disk fails as a
+* whole before anything is copied.
+*
+* Returns: 0 if the copy was successful; the disk status register of the
+* first failed transfer otherwise
+*/
+int disk_copy(int src_unit, int src, int dst_unit, int dst, int sectors){
+	int chunks = (sectors + DISK_COPY_CHUNK - 1) / DISK_COPY_CHUNK;
+	int physical = (src_unit==0 || src_unit==1) && (dst_unit==0 || dst_unit==1);
+
+	// With the destination ahead in the same region, go from the end so
+	// that no chunk is overwritten before it is read
+	int backwards = src_unit==dst_unit && dst>src && dst<src+sectors;
+
+	if(src + sectors > disk_unit_sectors(src_unit) || dst + sectors > disk_unit_sectors(dst_unit))
+		return USLOSS_DEV_ERROR;
+
+	int status = 0;
+	disk_copy_lock();
+	for(int step=0; step<=chunks && status==0; step++){
+		disk_done done;
+		disk_done_init(&done, 0);
+		disk_list_node nodes[2];
+		int queued[2] = {0, 0};
+		int counts[2] = {0, 0};
+
+		// Write the chunk read on the last step, then read this step's
+		for(int i=0; i<2; i++){
+			int chunk = step - 1 + i;
+			if(chunk<0 || chunk>=chunks)
+				continue;
+			int order = backwards ? chunks-1-chunk : chunk;
+			int offset = order*DISK_COPY_CHUNK;
+			int count = sectors - offset < DISK_COPY_CHUNK ? sectors - offset : DISK_COPY_CHUNK;
+			int operation = i==0 ? WRITE : READ;
+			int unit = i==0 ? dst_unit : src_unit;
+			int lba = (i==0 ? dst : src) + offset;
+			char* buffer = disk_copy_buffer[chunk%2];
+
+			KTRACE(KTRACE_DISK, operation==READ ? KTRACE_DISK_READ : KTRACE_DISK_WRITE, unit, lba/16);
+			counts[i] = count;
+			if(physical)
+				queued[i] = disk_io_start(unit, operation, buffer, lba/16, lba%16, count, &nodes[i], &done);
 			else{
-				// Insert value that isn't greater than head of list
-				// Put in order in first part of list
-				while(curr->next!=NULL && (curr->next->track < new_node.track) && (curr->track<curr->next->track)){
-					curr = curr->next;
-				}
-				new_node.next = curr->next;
-				curr->next = &new_node;
+				status = disk_unit_io(unit, operation, buffer, lba/16, lba%16, count);
+				disk_account(getpid(), operation, count);
 			}
-			disk_unlock0();
+			if(status!=0)
+				break;
+		}
+		if(!physical)
+			continue;
+
+		wait_on_unless(&done.waiters, 0, disk_done_ready, &done);
+		for(int i=0; i<2; i++){
+			if(counts[i]>0)
+				disk_account(getpid(), i==0 ? WRITE : READ, counts[i]);
+			if(!queued[i])
+				continue;
+			proc_io_disk(&nodes[i]);
+			if(status==0)
+				status = nodes[i].response_status;
 		}
 	}
-	else{ // Same as above but for disk 1
-		disk_lock1();
-		if(disk_list1==NULL){
+	disk_copy_unlock();
+	return status;
+}
+
+/**
+* Writes pattern to every byte of a range of sectors. A range running past
+* the end of the unit fails as a whole before anything is written. On a
+* physical unit one request is queued whose every sector comes from the
+* shared block for the pattern, so it can be merged with other fills; the
+* check up front keeps a merged request from failing for its neighbours.
+* The mirrored and striped units are written a chunk at a time from the
+* DiskCopy buffers.
+*
+* Returns: 0 if the transfer was successful; the disk status register otherwise
+*/
+int disk_fill(int unit, int track, int first, int sectors, int pattern){
+	if(sectors==0)
+		return 0;
+	if(track*16 + first + sectors > disk_unit_sectors(unit))
+		return USLOSS_DEV_ERROR;
+
+	if(unit==0 || unit==1){
+		disk_done done;
+		disk_done_init(&done, 1);
+		disk_list_node node;
+		disk_node_init(&node, WRITE, disk_fill_get(pattern), track, first, sectors, &done);
+		node.fill = 1;
+		disk_submit(unit, &node);
+		wait_on_unless(&done.waiters, 0, disk_done_ready, &done);
+		disk_fill_put(node.buffer);
+		proc_io_disk(&node);
+		return node.response_status;
+	}
 
-			
-			disk_list1 = &new_node;
-			disk_unlock1();
-	
-			wait_get_tracks(unit);
-			
-			int num=0;
-			USLOSS_DeviceRequest req;
- 			req.opr = USLOSS_DISK_TRACKS;
-			req.reg1 = (void*)&num;
-			USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
+	int status = 0;
+	disk_copy_lock();
+	memset(disk_copy_buffer[0], pattern, sizeof(disk_copy_buffer[0]));
+	while(sectors>0 && status==0){
+		int count = sectors < DISK_COPY_CHUNK ? sectors : DISK_COPY_CHUNK;
+		status = disk_unit_io(unit, WRITE, disk_copy_buffer[0], track, first, count);
+		first += count;
+		track += first/16;
+		first %= 16;
+		sectors -= count;
+	}
+	disk_copy_unlock();
+	return status;
+}
+
+/**
+* Takes a reference to the kernel block holding pattern in every byte,
+* waiting for a block to be free if all hold other patterns
+*
+* Returns: the block
+*/
+char* disk_fill_get(int pattern){
+	while(1){
+		unsigned int psr = wait_lock();
+		disk_fill_block* unused = NULL;
+		for(int i=0; i<DISK_FILL_BLOCKS; i++){
+			disk_fill_block* block = &disk_fill_blocks[i];
+			if(block->pattern==pattern){
+				block->users++;
+				wait_unlock(psr);
+				return block->data;
+			}
+			if(block->users==0 && unused==NULL)
+				unused = block;
+		}
+		if(unused!=NULL){
+			unused->pattern = pattern;
+			unused->users = 1;
+			memset(unused->data, pattern, sizeof(unused->data));
+			wait_unlock(psr);
+			return unused->data;
+		}
+		wait_unlock(psr);
+		wait_on_unless(&disk_fill_queue, 0, disk_fill_available, NULL);
+	}
+}
+
+/**
+* Drops a reference taken with disk_fill_get
+*/
+void disk_fill_put(char* data){
+	disk_fill_block* block = (disk_fill_block*)(data - offsetof(disk_fill_block, data));
+	unsigned int psr = wait_lock();
+	block->users--;
+	if(block->users==0)
+		wake_all(&disk_fill_queue, 0);
+	wait_unlock(psr);
+}
+
+/**
+* Returns 1 if a pattern block is not in use
+*/
+int disk_fill_available(void* arg){
+	for(int i=0; i<DISK_FILL_BLOCKS; i++)
+		if(disk_fill_blocks[i].users==0)
+			return 1;
+	return 0;
+}
+
+/**
+* Starts one request taken from an io ring. An invalid request, or one
+* that cannot be started asynchronously, completes at once.
+*
+* Returns: 0 if the request was left in the ring for lack of kernel
+* resources; 1 otherwise
+*/
+int io_submit(int id, io_sqe* sqe){
+	io_request* req;
+	int operation = sqe->opcode==IO_OP_DISK_READ || sqe->opcode==IO_OP_TERM_READ ? READ : WRITE;
+	switch(sqe->opcode){
+	case IO_OP_DISK_READ:
+	case IO_OP_DISK_WRITE: {
+		// Same arguments as DiskRead/DiskWrite
+		USLOSS_Sysargs call;
+		call.arg1 = sqe->buffer;
+		call.arg2 = (void*)(long) sqe->length;
+		call.arg3 = (void*)(long) sqe->track;
+		call.arg4 = (void*)(long) sqe->first;
+		call.arg5 = (void*)(long) sqe->unit;
+		if(sqe->buffer==NULL || !disk_args_valid(&call))
+			break;
+		if(sqe->unit!=0 && sqe->unit!=1){
+			// The mirrored and striped units are driven by the caller
+			unsigned int psr = wait_lock();
+			io_rings[id].inflight++;
+			wait_unlock(psr);
+			disk_helper(&call, operation);
+			io_post(id, sqe->user_data, (int)(long) call.arg1);
+			return 1;
+		}
+
+		req = io_request_alloc(id, sqe->user_data);
+		if(req==NULL)
+			return 0;
+		req->unit = sqe->unit;
+		KTRACE(KTRACE_DISK, operation==READ ? KTRACE_DISK_READ : KTRACE_DISK_WRITE, sqe->unit, sqe->track);
+		if(!disk_io_start(sqe->unit, operation, sqe->buffer, sqe->track, sqe->first, sqe->length, &req->node, &req->done)){
+			// Served from the read-ahead cache
+			disk_account(getpid(), operation, sqe->length);
+			io_request_free(req);
+			io_post(id, sqe->user_data, 0);
+		}
+		return 1;
+	}
+	case IO_OP_TERM_READ:
+	case IO_OP_TERM_WRITE: {
+		if(sqe->buffer==NULL || sqe->length < 1 || sqe->length > MAXLINE ||
+				sqe->unit < 0 || sqe->unit >= USLOSS_TERM_UNITS)
+			break;
+		term_async_lock();
+		term_async* treq = term_async_alloc(-1);
+		if(treq==NULL){
+			term_async_unlock();
+			return 0;
+		}
+		unsigned int psr = wait_lock();
+		io_rings[id].inflight++;
+		wait_unlock(psr);
+		treq->ring = id;
+		treq->user_data = sqe->user_data;
+		treq->tag = 0;
+		treq->operation = operation==READ ? TERM_ASYNC_READ : TERM_ASYNC_WRITE;
+		treq->unit = sqe->unit;
+		treq->size = sqe->length;
+		treq->buffer = NULL;
+		if(operation==READ){
+			treq->buffer = sqe->buffer;
 		}
 		else{
-			disk_list_node* curr = disk_list1;
-			if(new_node.track < curr->track){
-				while(curr->next!=NULL && curr->track <= curr->next->track){
-					curr = curr->next;
-				}
-				while(curr->next!=NULL && (curr->next->track < new_node.track)){
-					curr = curr->next;
-				}
-				new_node.next = curr->next;
-				curr->next = &new_node;
-			}
-			else{
-				while(curr->next!=NULL && (curr->next->track < new_node.track) && (curr->track<curr->next->track)){
-					curr = curr->next;
-				}
-				new_node.next = curr->next;
-				curr->next = &new_node;
-			}
-			disk_unlock1();
+			memcpy(treq->data, sqe->buffer, sqe->length);
+			treq->data[sqe->length] = '\0';
 		}
+		term_async_start(treq);
+		term_async_unlock();
+		return 1;
+	}
+	case IO_OP_TIMEOUT:
+		if(sqe->length<0)
+			break;
+		req = io_request_alloc(id, sqe->user_data);
+		if(req==NULL)
+			return 0;
+		req->deadline = time_counter + sqe->length;
+		io_timeout_add(req);
+		return 1;
+	}
+
+	// Invalid request
+	unsigned int psr = wait_lock();
+	io_rings[id].inflight++;
+	wait_unlock(psr);
+	io_post(id, sqe->user_data, -1);
+	return 1;
+}
 
+/**
+* Posts a completion to an io ring for one of its requests in flight, and
+* wakes the owner if that is what it was waiting for. Once the owner is
+* quitting the ring may no longer be there, so only the count is kept.
+* Never blocks.
+*/
+void io_post(int id, long user_data, int result){
+	io_ring_state* state = &io_rings[id];
+	unsigned int psr = wait_lock();
+	if(!state->closing){
+		io_ring* ring = state->ring;
+		io_cqe* cqe = &ring->cq[ring->cq_tail % IO_RING_ENTRIES];
+		cqe->user_data = user_data;
+		cqe->result = result;
+		__atomic_store_n(&ring->cq_tail, ring->cq_tail+1, __ATOMIC_RELEASE);
 	}
+	state->inflight--;
+	if(state->waiters.waiting>0 && io_ring_ready(state))
+		wake_all(&state->waiters, 0);
+	wait_unlock(psr);
+}
 
-	
-	// Recv on specified mailbox, so daemon can wake me up at the right time
-	void* empty_message = "";
-	MboxRecv(my_mailbox_num, empty_message, 0);	
-	
-	//Operation is complete
-	MboxRelease(my_mailbox_num);
-	args->arg1 = (void*)(long)new_node.response_status;
-	args->arg4 = (void*)(long)0;
+/**
+* Returns 1 once an io ring has as many completions as its owner wants
+* waiting to be taken, or has nothing left in flight
+*/
+int io_ring_ready(void* state){
+	io_ring_state* ring_state = (io_ring_state*) state;
+	if(ring_state->inflight==0)
+		return 1;
+	if(ring_state->closing)
+		return 0;
+	io_ring* ring = ring_state->ring;
+	unsigned int unreaped = ring->cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+	return unreaped >= ring_state->want;
 }
 
-int get_tracks(char* args){
-	get_track_count(0);
-	get_track_count(1);
+/**
+* Frees the io rings of a process that is quitting. Terminal requests and
+* timeouts, which could take any time, are cancelled; disk requests
+* already queued are waited for. Nothing is posted to the rings meanwhile.
+*/
+void io_ring_release(int pid){
+	for(int id=0; id<IO_RING_MAX; id++){
+		io_ring_state* state = &io_rings[id];
+		if(state->ring==NULL || state->pid!=pid)
+			continue;
+		unsigned int psr = wait_lock();
+		state->closing = 1;
+		wait_unlock(psr);
+		term_async_lock();
+		term_async_cancel(-1, id);
+		term_async_unlock();
+		io_timeout_cancel(id);
+
+		// Only disk requests can be left in flight
+		wait_on_unless(&state->waiters, 0, io_ring_ready, state);
+		state->ring = NULL;
+	}
+}
 
-	USLOSS_Sysargs sysArgs0;
- 	sysArgs0.arg1 = (void *) ( (long) 0);
-	DiskSize_handler(&sysArgs0);
+/**
+* Takes a request from the pool for io ring id and counts it in flight
+*
+* Returns: the request, or NULL if the pool is empty
+*/
+io_request* io_request_alloc(int id, long user_data){
+	unsigned int psr = wait_lock();
+	io_request* req = io_request_free_list;
+	if(req!=NULL){
+		io_request_free_list = req->next;
+		io_rings[id].inflight++;
+	}
+	wait_unlock(psr);
+	if(req==NULL)
+		return NULL;
+	req->ring = id;
+	req->user_data = user_data;
+	req->next = NULL;
+	disk_done_init(&req->done, 0);
+	req->done.complete = io_disk_complete;
+	return req;
+}
 
-	USLOSS_Sysargs sysArgs1;
- 	sysArgs1.arg1 = (void *) ( (long) 1);
-	DiskSize_handler(&sysArgs1);
+/**
+* Returns a request to the pool
+*/
+void io_request_free(io_request* req){
+	unsigned int psr = wait_lock();
+	req->next = io_request_free_list;
+	io_request_free_list = req;
+	wait_unlock(psr);
 }
 
-void get_track_count(int unit){
-	USLOSS_DeviceRequest req;
-	int num;
-	int status;
-	req.opr = USLOSS_DISK_TRACKS;
-	req.reg1 = &num;
-	if(DEBUG)
-		USLOSS_Console("Sending request in get track %d\n", unit);
-	USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
-	waitDevice(USLOSS_DISK_DEV, unit, &status);
-	if(DEBUG)
-		USLOSS_Console("After wait dev in get track %d\n", unit);
-	if(unit==0){
-		track_count_lock0();
-		track_count0 = num;
-		track_count_unlock0();
-		track_list_lock0();
-		track_list_node* curr = track_list0;
-		
-		while(curr!=NULL){
-			curr->response = track_count0;
-			
-			void* empty_message = "";
-			MboxSend(curr->mailbox_num, empty_message, 0);
-			curr = curr->next;
+/**
+* Completes an io ring's disk request; called by the disk daemon in place
+* of waking a caller
+*/
+void io_disk_complete(disk_list_node* node){
+	io_request* req = (io_request*)((char*)node - offsetof(io_request, node));
+	int ring = req->ring;
+	long user_data = req->user_data;
+	int status = node->response_status;
+	proc_io_disk(node);
+	disk_account(node->pid, node->operation, node->sectors);
+	KTRACE(KTRACE_DISK, KTRACE_DISK_DONE, req->unit, status);
+	io_request_free(req);
+	io_post(ring, user_data, status);
+}
+
+/**
+* Counts a finished disk transfer in its process's I/O accounting
+*/
+void disk_account(int pid, int operation, int sectors){
+	proc_data* proc = proc_get(pid);
+	proc_io_counters* io = operation==READ ? &proc->io.disk_read : &proc->io.disk_write;
+	io->ops++;
+	io->bytes += sectors*512;
+}
+
+/**
+* Adds an io ring timeout to the pending ones, in expiry order
+*/
+void io_timeout_add(io_request* req){
+	unsigned int psr = wait_lock();
+	io_request** link = &io_timeouts;
+	while(*link!=NULL && (*link)->deadline <= req->deadline)
+		link = &(*link)->next;
+	req->next = *link;
+	*link = req;
+	wait_unlock(psr);
+}
+
+/**
+* Completes the io ring timeouts that have expired by tick now
+*/
+void io_timeout_expire(long now){
+	while(1){
+		unsigned int psr = wait_lock();
+		io_request* req = io_timeouts;
+		if(req!=NULL && req->deadline <= now)
+			io_timeouts = req->next;
+		else
+			req = NULL;
+		wait_unlock(psr);
+		if(req==NULL)
+			return;
+
+		int ring = req->ring;
+		long user_data = req->user_data;
+		io_request_free(req);
+		io_post(ring, user_data, 0);
+	}
+}
+
+/**
+* Completes the pending timeouts of io ring id with -1, without waiting for
+* them to expire
+*/
+void io_timeout_cancel(int id){
+	io_request* cancelled = NULL;
+	unsigned int psr = wait_lock();
+	io_request** link = &io_timeouts;
+	while(*link!=NULL){
+		io_request* req = *link;
+		if(req->ring==id){
+			*link = req->next;
+			req->next = cancelled;
+			cancelled = req;
 		}
-	
-		track_list_unlock0();
+		else
+			link = &req->next;
 	}
-	else{
-		track_count_lock1();
-		track_count1 = num;
-		track_count_unlock1();
-		track_list_lock1();
-		track_list_node* curr = track_list1;
-		while(curr!=NULL){
-			curr->response = track_count1;
-			
-			void* empty_message = "";
-			MboxSend(curr->mailbox_num, empty_message, 0);
-			curr = curr->next;
+	wait_unlock(psr);
+
+	while(cancelled!=NULL){
+		io_request* req = cancelled;
+		cancelled = req->next;
+		long user_data = req->user_data;
+		io_request_free(req);
+		io_post(id, user_data, -1);
+	}
+}
+
+/**
+* Fills in a disk queue node for an operation of the current process, which
+* will be woken through done when it completes
+*/
+void disk_node_init(disk_list_node* node, int operation, char* buffer, int track, int start_block, int sectors, disk_done* done){
+	node->pid = getpid();
+	node->id = 0;
+	node->started = 0;
+	node->track = track;
+	node->done = done;
+	node->buffer = buffer;
+	node->sectors = sectors;
+	node->sectors_done = 0;
+	node->start_block = start_block;
+	node->operation = operation;
+	node->response_status = 0;
+	node->prefetch = 0;
+	node->piggybacks = 0;
+	node->queued_time = currentTime();
+	node->throttled_since = 0;
+	node->fill = 0;
+	node->merged = NULL;
+	node->next = NULL;
+}
+
+/**
+* Sets up what a caller waits on for pending requests it is about to queue
+*/
+void disk_done_init(disk_done* done, int pending){
+	done->pending = pending;
+	done->complete = NULL;
+	wait_queue_init(&done->waiters, 0);
+}
+
+/**
+* Returns 1 once every request counted in a disk_done has completed
+*/
+int disk_done_ready(void* done){
+	return ((disk_done*)done)->pending == 0;
+}
+
+/**
+* Counts a completed request off its caller's disk_done, waking the caller
+* with the last one. The node may be gone once this returns.
+*/
+void disk_done_signal(disk_list_node* node){
+	// Fills merged into this one were written with it
+	disk_list_node* merged = node->merged;
+	node->merged = NULL;
+	while(merged!=NULL){
+		disk_list_node* next = merged->merged;
+		merged->merged = NULL;
+		merged->response_status = node->response_status;
+		merged->dispatch_time = node->dispatch_time;
+		merged->complete_time = node->complete_time;
+		disk_done_signal(merged);
+		merged = next;
+	}
+
+	disk_done* done = node->done;
+	if(done->complete!=NULL){
+		done->complete(node);
+		return;
+	}
+	unsigned int psr = wait_lock();
+	done->pending--;
+	if(done->pending==0)
+		wake_all(&done->waiters, 0);
+	wait_unlock(psr);
+}
+
+/**
+* Queues an operation on a unit, waking the daemon if it was idle. Does not
+* wait for the operation to complete.
+*/
+void disk_submit(int unit, disk_list_node* node){
+	disk_lock(unit);
+	node->id = ++disk_trace_ids[unit];
+	disk_trace(unit, DISK_TRACE_ARRIVE, node, node->sectors);
+	disk_list_node* lead = node->fill ? disk_fill_merge(disk_write_queue[unit], node) : NULL;
+	if(lead!=NULL){
+		disk_trace(unit, DISK_TRACE_MERGE, node, lead->id);
+		disk_unit_stats[unit].fill_merged++;
+		disk_unlock(unit);
+		return;
+	}
+	// Claim a stalled unit's restart, so sleep_daemon doesn't poke it too
+	unsigned int psr = wait_lock();
+	int idle = (*disk_queue(unit)==NULL && disk_read_queue[unit]==NULL && disk_write_queue[unit]==NULL)
+		|| disk_stalled[unit];
+	disk_stalled[unit] = 0;
+	wait_unlock(psr);
+	if(node->operation==READ)
+		disk_queue_append(&disk_read_queue[unit], node);
+	else
+		disk_queue_append(&disk_write_queue[unit], node);
+	if(idle){
+		// Nothing ahead of us, so we go first, unless we are over our limit
+		idle = disk_dispatch(unit)!=NULL;
+	}
+	disk_unlock(unit);
+
+	if(idle){
+		// No one on queue (disk daemon idle)
+		disk_kick(unit);
+	}
+}
+
+/**
+* Striped unit: logical track t is track t/2 of unit t%2. The transfer is
+* cut at track boundaries and the pieces are queued on both units at once,
+* STRIPE_MAX_CHUNKS at a time, so both daemons work on it in parallel.
+*
+* Returns: 0 if the transfer was successful; the disk status register of the
+* first failed piece otherwise
+*/
+int stripe_io(int operation, char* buffer, int track, int start_block, int sectors){
+	int status = 0;
+	while(sectors>0){
+		disk_done done;
+		disk_done_init(&done, 0);
+		disk_list_node nodes[STRIPE_MAX_CHUNKS];
+		int chunks = 0;
+		while(sectors>0 && chunks<STRIPE_MAX_CHUNKS){
+			if(start_block==16){
+				track++;
+				start_block = 0;
+			}
+			int count = 16 - start_block;
+			if(count > sectors)
+				count = sectors;
+			disk_node_init(&nodes[chunks], operation, buffer, track/2, start_block, count, &done);
+			unsigned int psr = wait_lock();
+			done.pending++;
+			wait_unlock(psr);
+			disk_submit(track%2, &nodes[chunks]);
+			chunks++;
+
+			buffer += count*512;
+			start_block += count;
+			sectors -= count;
 		}
-		track_list_unlock1();
+		wait_on_unless(&done.waiters, 0, disk_done_ready, &done);
+		for(int i=0; i<chunks; i++)
+			proc_io_disk(&nodes[i]);
+
+		for(int i=0; i<chunks && status==0; i++)
+			status = nodes[i].response_status;
+		if(status!=0)
+			break;
 	}
+	return status;
 }
-void wait_get_tracks(int unit){
-	if(unit==0){
-		
-			track_count_lock0();
-			int count = track_count0;
-			track_count_unlock0();
-			if(count<0){
-
-				if(DEBUG)
-					USLOSS_Console("in write, track isn;t done yet\n");
-				int mailbox_num = MboxCreate(1,0);
-		
-				track_list_node new_node;
-				new_node.mailbox_num = mailbox_num;
-				new_node.next = NULL;
 
-	
-				track_list_lock0();
-	
-				if(track_list0==NULL){
-					track_list0 = &new_node;
-				}
-				else{
-					track_list_node* head = track_list0;
-			
-					new_node.next = head->next;
-					head->next = &new_node;
-				}
+/**
+* Mirrored unit: reads one copy, going to the half whose head is closest
+* once queued work is counted. If that fails, the other copy is tried.
+*
+* Returns: 0 if the transfer was successful; the disk status register otherwise
+*/
+int mirror_read(char* buffer, int track, int start_block, int sectors){
+	int unit = mirror_pick(track, start_block, sectors);
+	int status = disk_io(unit, READ, buffer, track, start_block, sectors);
+	if(status!=0 && !mirror_is_dirty(1-unit, track, start_block, sectors))
+		status = disk_io(1-unit, READ, buffer, track, start_block, sectors);
+	return status;
+}
+
+/**
+* Mirrored unit: writes both halves at the same time. If only one of them
+* fails, the write succeeds and the failed half's tracks are left for
+* mirror_daemon to resync.
+*
+* Returns: 0 if at least one copy was written; the disk status register otherwise
+*/
+int mirror_write(char* buffer, int track, int start_block, int sectors){
+	// Wait out a track copy, so resync never copies a track under a write
+	mirror_lock();
+	while(mirror_resync_busy){
+		mirror_unlock();
+		wait_on_unless(&mirror_turn_queue, 0, mirror_resync_idle, NULL);
+		mirror_lock();
+	}
+	mirror_active_writes++;
+	mirror_unlock();
+
+	disk_done done;
+	disk_done_init(&done, 2);
+	disk_list_node nodes[2];
+	for(int unit=0; unit<2; unit++){
+		disk_node_init(&nodes[unit], WRITE, buffer, track, start_block, sectors, &done);
+		disk_submit(unit, &nodes[unit]);
+	}
+	wait_on_unless(&done.waiters, 0, disk_done_ready, &done);
+	proc_io_disk(&nodes[0]);
+	proc_io_disk(&nodes[1]);
+
+	mirror_lock();
+	mirror_active_writes--;
+	if(mirror_active_writes==0)
+		wake_all(&mirror_drain_queue, 0);
+	int status = 0;
+	for(int unit=0; unit<2; unit++){
+		if(nodes[unit].response_status==0)
+			continue;
+		if(nodes[1-unit].response_status!=0)
+			status = nodes[unit].response_status;
+		else if(sectors>0)
+			mirror_mark_dirty(unit, track, track + (start_block+sectors-1)/16);
+	}
+	mirror_unlock();
+	return status;
+}
+
+/**
+* Chooses which half of the mirrored unit serves a read: the one with the
+* smallest seek distance plus MIRROR_QUEUE_COST per request ahead of it.
+* A half that is out of date anywhere in the range is never chosen.
+*/
+int mirror_pick(int track, int start_block, int sectors){
+	if(mirror_is_dirty(0, track, start_block, sectors))
+		return 1;
+	if(mirror_is_dirty(1, track, start_block, sectors))
+		return 0;
+
+	int best = 0;
+	int best_cost = -1;
+	for(int unit=0; unit<2; unit++){
+		disk_lock(unit);
+		int depth = 0;
+		disk_list_node* queues[3] = { *disk_queue(unit), disk_read_queue[unit], disk_write_queue[unit] };
+		for(int i=0; i<3; i++)
+			for(disk_list_node* node = queues[i]; node!=NULL; node = node->next)
+				depth++;
+		int cost = disk_head_track[unit] - track;
+		if(cost < 0)
+			cost = -cost;
+		cost += depth*MIRROR_QUEUE_COST;
+		disk_unlock(unit);
+		if(best_cost<0 || cost<best_cost){
+			best = unit;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+/**
+* Returns 1 if any track of a transfer is out of date on one half of the
+* mirrored unit
+*/
+int mirror_is_dirty(int unit, int track, int start_block, int sectors){
+	int dirty = 0;
+	mirror_lock();
+	if(mirror_dirty_count[unit]>0){
+		int last = track + (start_block+sectors-1)/16;
+		for(int t = track; t<=last && t<MIRROR_MAX_TRACKS && !dirty; t++)
+			dirty = t>=0 && mirror_dirty[unit][t];
+	}
+	mirror_unlock();
+	return dirty;
+}
+
+/**
+* Marks a range of tracks out of date on one half of the mirrored unit and
+* wakes mirror_daemon. Caller holds the mirror lock.
+*/
+void mirror_mark_dirty(int unit, int first_track, int last_track){
+	for(int t = first_track; t<=last_track && t<MIRROR_MAX_TRACKS; t++){
+		if(t>=0 && !mirror_dirty[unit][t]){
+			mirror_dirty[unit][t] = 1;
+			mirror_dirty_count[unit]++;
+		}
+	}
+	mirror_resync_signalled = 1;
+	wake_all(&mirror_resync_queue, 0);
+}
+
+/**
+* Finds a track that is out of date on one half of the mirrored unit and up
+* to date on the other. Caller holds the mirror lock.
+*
+* Returns: the track, with *unit set to the half to copy to, or -1
+*/
+int mirror_find_dirty(int* unit){
+	for(int u=0; u<2; u++){
+		if(mirror_dirty_count[u]==0)
+			continue;
+		for(int t=0; t<MIRROR_MAX_TRACKS; t++){
+			if(mirror_dirty[u][t] && !mirror_dirty[1-u][t]){
+				*unit = u;
+				return t;
+			}
+		}
+	}
+	return -1;
+}
+
+/**
+* Returns 1 once no mirror write is in progress
+*/
+int mirror_drained(void* arg){
+	return mirror_active_writes==0;
+}
+
+/**
+* Returns 1 once mirror_daemon is not copying a track
+*/
+int mirror_resync_idle(void* arg){
+	return !mirror_resync_busy;
+}
 
-				track_list_unlock0();
-				
-				void* empty_message = "";
-				MboxRecv(mailbox_num, empty_message, 0);	
-				MboxRelease(mailbox_num);
-			}
+/**
+* Asks a unit how many tracks it has and publishes its geometry, waking
+* anyone who needed it. Run by the unit's daemon before it takes any
+* requests, so both units are probed at the same time.
+*/
+void disk_probe(int unit){
+	USLOSS_DeviceRequest req;
+	int num;
+	int status;
+	req.opr = USLOSS_DISK_TRACKS;
+	req.reg1 = &num;
+	USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
+	waitDevice(USLOSS_DISK_DEV, unit, &status);
+	__atomic_store_n(&sys_info_block.disks[unit].tracks, num, __ATOMIC_RELEASE);
+	wake_key(&disk_probe_queue, unit, 0);
+}
 
+/**
+* Blocks until a unit has been probed
+*
+* Returns: the number of tracks of the unit
+*/
+int disk_wait_probe(int unit){
+	int tracks = disk_track_count(unit);
+	if(tracks<0){
+		wait_on_unless(&disk_probe_queue, unit, disk_probed, (void*)(long)unit);
+		tracks = disk_track_count(unit);
 	}
-	else{
-			track_count_lock1();
-			int count = track_count1;
-			track_count_unlock1();
-			if(count<0){
-
-				if(DEBUG)
-					USLOSS_Console("in write, track isn;t done yet\n");
-				int mailbox_num = MboxCreate(1,0);
-		
-				track_list_node new_node;
-				new_node.mailbox_num = mailbox_num;
-				new_node.next = NULL;
-
-	
-				track_list_lock1();
-	
-				if(track_list1==NULL){
-					track_list1 = &new_node;
-				}
-				else{
-					track_list_node* head = track_list1;
-			
-					new_node.next = head->next;
-					head->next = &new_node;
-				}
+	return tracks;
+}
 
-				track_list_unlock1();
-				
-				void* empty_message = "";
-				MboxRecv(mailbox_num, empty_message, 0);	
-				MboxRelease(mailbox_num);
-			}
-	}
+/**
+* Returns 1 once a unit's geometry has been published
+*/
+int disk_probed(void* unit){
+	return disk_track_count((int)(long)unit)>=0;
 }
 
 int disk_daemon(char* arg){
@@ -763,121 +2995,143 @@ int disk_daemon(char* arg){
 	int unit = (int)(long)arg;
 	disk_list_node* curr;
 	USLOSS_DeviceRequest req;
-	wait_get_tracks(unit);
+	int track_num;
+	disk_probe(unit);
 	while(1){
-		if(DEBUG)
-			USLOSS_Console("Before waitDevice in Disk %d\n", unit);
 		waitDevice(USLOSS_DISK_DEV, unit, &status);
-		if(DEBUG)
-			USLOSS_Console("After waitDevice in disk %d\n", unit);
-		// grab next proc off queue
-		if(unit==0){
-			disk_lock0();
-			curr = disk_list0;
-			disk_unlock0();
-		}
-		else{
-			if(DEBUG)
-				USLOSS_Console("get curr from unit1\n");
-			disk_lock1();
-			curr = disk_list1;
-			disk_unlock1();
-		}
+		KTRACE(KTRACE_DISK, KTRACE_DISK_INTERRUPT, unit, status);
+		// grab next proc off queue, dispatching a waiting one if idle
+		disk_lock(unit);
+		curr = *disk_queue(unit);
+		if(curr==NULL)
+			curr = disk_dispatch(unit);
+		disk_unlock(unit);
 		if(curr!=NULL){
-			if(DEBUG)
-				USLOSS_Console("curr is not null\n");
 		if(status == USLOSS_DEV_ERROR){
-			if(DEBUG)
-				USLOSS_Console("Status is error\n");
-			if(unit==0){
-				disk_lock0();
-				disk_list0 = disk_list0->next;
-				disk_unlock0();
+			disk_lock(unit);
+			*disk_queue(unit) = curr->next;
+			if(curr!=&ra_node[unit])
+				disk_record_latency(unit, curr);
+			disk_trace(unit, DISK_TRACE_COMPLETE, curr, status);
+			disk_unlock(unit);
+
+			// Wake up the process for this operation
+			curr->response_status = status;
+			if(curr==&ra_node[unit]){
+				// Failed prefetch, nobody is waiting on it
+				curr->started = 0;
 			}
 			else{
-				disk_lock1();
-				disk_list1 = disk_list1->next;
-				disk_unlock1();
+				disk_done_signal(curr);
 			}
-			// Wake up the process for this operation
-			curr->response_status = status;
-			void* empty_message = "";
-			MboxSend(curr->mailbox_num, empty_message, 0);
+
+			// Cheap request so the next interrupt moves on to the
+			// remaining work
+			req.opr = USLOSS_DISK_TRACKS;
+			req.reg1 = &track_num;
+			USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
 		}
 		else{
-			if(DEBUG)
-				USLOSS_Console("Status isnt error\n");
 			if(curr->started){
-				if(DEBUG)
-					USLOSS_Console("Continuing an op\n");
 				// At correct track, ready to read/write
 				//else if(curr->sectors == 0){
 				if(curr->sectors_done == curr->sectors){
 					// If operation is done remove from queue
 					// grab next proc off queue
-					if(DEBUG)
-						USLOSS_Console("done w op\n");
-					if(unit==0){
-						disk_lock0();
-						curr = disk_list0;
-						disk_list0 = curr->next;
-						disk_unlock0();
+					disk_lock(unit);
+					curr = *disk_queue(unit);
+					*disk_queue(unit) = curr->next;
+					disk_trace(unit, DISK_TRACE_COMPLETE, curr, status);
+					if(curr==&ra_node[unit]){
+						// Prefetch finished, publish it to the cache
+						ra_cache_install(unit);
+						curr->started = 0;
 					}
 					else{
-						disk_lock1();
-						curr = disk_list1;
-						disk_list1 = curr->next;
-						disk_unlock1();
+						disk_record_latency(unit, curr);
+
+						if(curr->prefetch>0 && !ra_node[unit].started){
+							// Head is already in place, so keep reading
+							// ahead into the kernel buffer for this stream
+							ra_start_lba[unit] = curr->track*16 + curr->start_block;
+							ra_node[unit] = *curr;
+							ra_node[unit].done = NULL;
+							ra_node[unit].buffer = ra_buffer[unit];
+							ra_node[unit].sectors = curr->prefetch;
+							ra_node[unit].sectors_done = 0;
+							ra_node[unit].prefetch = 0;
+							ra_node[unit].piggybacks = 0;
+							ra_node[unit].id = ++disk_trace_ids[unit];
+							*disk_queue(unit) = &ra_node[unit];
+							disk_trace(unit, DISK_TRACE_PREFETCH, &ra_node[unit], ra_node[unit].sectors);
+						}
 					}
+					disk_unlock(unit);
+
 					// Wake up the process for this operation
-					curr->response_status = status;
-					void* empty_message = "";
-					MboxSend(curr->mailbox_num, empty_message, 0);
+					if(curr!=&ra_node[unit]){
+						curr->response_status = status;
+						disk_done_signal(curr);
+					}
 				}
 				else{
-					if(DEBUG)
-						USLOSS_Console("Keep continuing\n");
 					
 					int block = curr->start_block;
-					if(block==16){
-						if(DEBUG)
-							USLOSS_Console("cross to next sector\n");
+					disk_list_node* same_track = NULL;
+					if(block==16 && curr->piggybacks<DISK_PIGGYBACK_MAX){
+						// Before leaving this track, let short requests
+						// queued for it go first
+						disk_lock(unit);
+						same_track = disk_take_same_track(unit, curr);
+						disk_unlock(unit);
+					}
+					if(same_track!=NULL){
+						// Head is already on the track, no seek needed
+						curr->piggybacks++;
+						same_track->started = 1;
+						disk_sector_request(unit, same_track, &req);
+					}
+					else if(block==16){
 						// Cross to next sector
 						curr->start_block = 0;
 						curr->track++;
+						curr->piggybacks = 0;
 						
 						req.opr = USLOSS_DISK_SEEK;
 						req.reg1 = curr->track;
+						disk_head_track[unit] = curr->track;
+						disk_trace(unit, DISK_TRACE_SEEK, curr, curr->track);
 					}
 					else{
-					int buff_offset = curr->sectors_done;
-					curr->sectors_done++;
-					curr->start_block++;
-					
-					int block_index = block;
-					char *buf = (curr->buffer)+(buff_offset*512);
-					if(DEBUG)
-						USLOSS_Console("Gonna do write/read block %d blcok index %d track %d of buff %p\n", block, block_index, curr->track, buf);
-					req.reg1 = (void*)(long)block_index;
-					req.reg2 = buf;
-					if(curr->operation==READ){
-						req.opr = USLOSS_DISK_READ;
-					}
-					else{
-						req.opr = USLOSS_DISK_WRITE;
-					}
+						disk_sector_request(unit, curr, &req);
 					}
 				}
 			}
 			else{
-				if(DEBUG)
-					USLOSS_Console("Strating new op\n");
 				curr->started = 1;
+
+				// A stream's prefetch may have landed while this was queued
+				int hit = 0;
+				if(curr->operation==READ){
+					disk_lock(unit);
+					hit = ra_cache_read(unit, curr->track*16 + curr->start_block, curr->sectors, curr->buffer);
+					if(hit)
+						curr->prefetch = 0;
+					disk_unlock(unit);
+				}
+				if(hit){
+					// Nothing to transfer, finish it on the next interrupt
+					curr->sectors_done = curr->sectors;
+					req.opr = USLOSS_DISK_TRACKS;
+					req.reg1 = &track_num;
+				}
+				else{
 					req.opr = USLOSS_DISK_SEEK;
 					req.reg1 = curr->track;
+					disk_head_track[unit] = curr->track;
+					disk_trace(unit, DISK_TRACE_SEEK, curr, curr->track);
+				}
 			}
-			if(DEBUG)
-				USLOSS_Console("Sending a request\n");
 			USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
 		}
 		}
@@ -886,9 +3140,557 @@ int disk_daemon(char* arg){
 	return 0;
 }
 
+/**
+* Copies out of date tracks of the mirrored unit from the good half, one
+* track at a time, whenever mirror_mark_dirty signals there is work. Mirror
+* writes can run between tracks; the mirror lock is not held during the copy.
+*/
+int mirror_daemon(char* arg){
+	proc_get(getpid())->priority = MIRROR_RESYNC_PRIORITY;
+	while(1){
+		wait_on_unless(&mirror_resync_queue, 0, wait_flag_set, &mirror_resync_signalled);
+		mirror_resync_signalled = 0;
+		while(1){
+			mirror_lock();
+			int unit;
+			int track = mirror_find_dirty(&unit);
+			if(track<0){
+				mirror_unlock();
+				break;
+			}
+
+			// Hold off new writes and let those already running land
+			mirror_resync_busy = 1;
+			while(mirror_active_writes>0){
+				mirror_unlock();
+				wait_on_unless(&mirror_drain_queue, 0, mirror_drained, NULL);
+				mirror_lock();
+			}
+			mirror_unlock();
+
+			int status = disk_io(1-unit, READ, mirror_buffer, track, 0, 16);
+			if(status==0)
+				status = disk_io(unit, WRITE, mirror_buffer, track, 0, 16);
+
+			mirror_lock();
+			if(status==0 && mirror_dirty[unit][track]){
+				mirror_dirty[unit][track] = 0;
+				mirror_dirty_count[unit]--;
+			}
+			mirror_resync_busy = 0;
+			wake_all(&mirror_turn_queue, 0);
+			mirror_unlock();
+
+			// Leave it for the next signal rather than spin on a bad disk
+			if(status!=0)
+				break;
+		}
+	}
+	return 0;
+}
+
+
+/**
+* Fills in the request for the next sector of a started operation and
+* advances the operation past it.
+*/
+void disk_sector_request(int unit, disk_list_node* node, USLOSS_DeviceRequest* req){
+	int block = node->start_block;
+	int buff_offset = node->sectors_done;
+	disk_trace(unit, DISK_TRACE_SECTOR, node, buff_offset);
+	node->sectors_done++;
+	node->start_block++;
+
+	char *buf = node->fill ? node->buffer : (node->buffer)+(buff_offset*512);
+	req->reg1 = (void*)(long)block;
+	req->reg2 = buf;
+	if(node->operation==READ){
+		req->opr = USLOSS_DISK_READ;
+	}
+	else{
+		req->opr = USLOSS_DISK_WRITE;
+		disk_lock(unit);
+		ra_cache_invalidate(unit, node->track*16 + block);
+		disk_unlock(unit);
+	}
+}
+
+/**
+* Called by sleep_daemon on every clock tick. Tops up the token buckets of
+* all limited processes for the time since the last tick, then pokes any
+* unit that was stalled with only throttled requests waiting; its daemon
+* dispatches them when the poke's interrupt arrives. Never blocks, so the
+* clock is not held up behind the disk: the buckets are refilled with
+* interrupts off instead of under the disk locks.
+*/
+void disk_qos_refill(void){
+	if(!qos_enabled)
+		return;
+	int stalled[2];
+	unsigned int psr = wait_lock();
+	int now = currentTime();
+	long elapsed = now - qos_last_refill;
+	qos_last_refill = now;
+
+	for(int i=0; i<MAXPROC; i++){
+		proc_data* proc = &procs[i];
+		if(proc->sector_rate>0){
+			proc->sector_credit += proc->sector_rate*elapsed/1000;
+			if(proc->sector_credit > proc->sector_rate*1000L*DISK_QOS_BURST)
+				proc->sector_credit = proc->sector_rate*1000L*DISK_QOS_BURST;
+		}
+		if(proc->op_rate>0){
+			proc->op_credit += proc->op_rate*elapsed/1000;
+			if(proc->op_credit > proc->op_rate*1000L*DISK_QOS_BURST)
+				proc->op_credit = proc->op_rate*1000L*DISK_QOS_BURST;
+		}
+	}
+	for(int unit=0; unit<2; unit++){
+		stalled[unit] = disk_stalled[unit] && disk_probed((void*)(long)unit);
+		if(stalled[unit])
+			disk_stalled[unit] = 0;
+	}
+	wait_unlock(psr);
+
+	for(int unit=0; unit<2; unit++){
+		if(stalled[unit])
+			disk_poke(unit);
+	}
+}
+
+/**
+* Appends a record to a unit's trace ring. Cheap enough to leave on: no
+* locking and no console output. The slot is claimed before it is filled,
+* so a record interrupted halfway can at worst be half written.
+*/
+void disk_trace(int unit, int event, disk_list_node* node, int arg){
+	disk_trace_record* rec = &disk_trace_ring[unit][disk_trace_total[unit]++ % DISK_TRACE_RECORDS];
+	rec->time = currentTime();
+	rec->event = event;
+	rec->pid = node->pid;
+	rec->id = node->id;
+	rec->operation = node->operation;
+	rec->track = node->track;
+	rec->block = node->start_block;
+	rec->arg = arg;
+}
+
+/**
+* Appends a record to a subsystem's trace ring, for the KTRACE() macro. Safe
+* to call from any process without a lock: the slot is claimed atomically,
+* and the record's seq is set last so that KTrace_handler can tell a
+* finished record from one still being filled in.
+*/
+void ktrace(int subsystem, int event, int arg1, int arg2){
+	int slot = __atomic_fetch_add(&ktrace_total[subsystem], 1, __ATOMIC_RELAXED);
+	ktrace_record* rec = &ktrace_ring[subsystem][slot % KTRACE_RECORDS];
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	rec->time = currentTime();
+	rec->event = event;
+	rec->pid = getpid();
+	rec->arg1 = arg1;
+	rec->arg2 = arg2;
+	__atomic_store_n(&rec->seq, slot+1, __ATOMIC_RELEASE);
+}
+
+/**
+* Clock interrupt handler installed over the one from the lower phases.
+* While profiling, charges the tick to whichever process it interrupted,
+* in user or kernel mode according to the mode saved in the PSR, then
+* passes the interrupt on.
+*/
+void profile_clock_interrupt(int dev, void* arg){
+	if(profile_running){
+		int pid = getpid();
+		int slot = pid % PROFILE_PIDS;
+		for(int i=0; i<PROFILE_PIDS; i++){
+			profile_sample* sample = &profile_table[(slot+i) % PROFILE_PIDS];
+			if(sample->pid!=pid && sample->pid!=0)
+				continue;
+			sample->pid = pid;
+			if(USLOSS_PsrGet() & USLOSS_PSR_PREV_MODE)
+				sample->kernel_samples++;
+			else
+				sample->user_samples++;
+			break;
+		}
+		profile_ticks++;
+	}
+	phase2_clock_interrupt(dev, arg);
+}
+
+/**
+* Charges a finished disk request's time in the queue and on the device to
+* the process that made it
+*/
+void proc_io_disk(disk_list_node* node){
+	proc_data* proc = proc_get(node->pid);
+	proc_io_counters* io = node->operation==READ ? &proc->io.disk_read : &proc->io.disk_write;
+	io->queued_time += node->dispatch_time - node->queued_time;
+	io->service_time += node->complete_time - node->dispatch_time;
+}
+
+static void proc_io_print(int pid, char* name, proc_io_counters* io){
+	if(io->ops==0)
+		return;
+	USLOSS_Console("proc_io: pid %d %-10s ops %d bytes %ld queued_us %ld service_us %ld\n",
+		pid, name, io->ops, io->bytes, io->queued_time, io->service_time);
+}
+
+/**
+* Prints the I/O accounting of a process, if it did any
+*/
+void proc_io_dump(int pid){
+	proc_data* proc = proc_find(pid);
+	if(proc==NULL)
+		return;
+	proc_io_print(pid, "disk_read", &proc->io.disk_read);
+	proc_io_print(pid, "disk_write", &proc->io.disk_write);
+	proc_io_print(pid, "term_read", &proc->io.term_read);
+	proc_io_print(pid, "term_write", &proc->io.term_write);
+	proc_io_print(pid, "sleep", &proc->io.sleep);
+	if(proc->io.lock_time>0)
+		USLOSS_Console("proc_io: pid %d lock_us %ld\n", pid, proc->io.lock_time);
+}
+
+/**
+* Counts a finished operation and the time it spent from arrival to
+* completion. Caller holds the disk lock for unit.
+*/
+void disk_record_latency(int unit, disk_list_node* node){
+	node->complete_time = currentTime();
+	int latency = node->complete_time - node->queued_time;
+	disk_stats* stats = &disk_unit_stats[unit];
+	if(node->operation==READ){
+		stats->reads++;
+		stats->read_latency_total += latency;
+		if(latency > stats->read_latency_max)
+			stats->read_latency_max = latency;
+	}
+	else{
+		stats->writes++;
+		stats->write_latency_total += latency;
+		if(latency > stats->write_latency_max)
+			stats->write_latency_max = latency;
+	}
+}
+
+/**
+* Returns the read-ahead stream of the current process, restarting it if
+* the slot belonged to another process or the process switched units.
+*/
+ra_stream* ra_get_stream(int unit){
+	int pid = getpid();
+	ra_stream* stream = &ra_streams[pid % MAXPROC];
+	if(stream->pid!=pid || stream->unit!=unit){
+		stream->pid = pid;
+		stream->unit = unit;
+		stream->next_lba = -1;
+		stream->window = 0;
+	}
+	return stream;
+}
+
+/**
+* Copies sectors [lba, lba+sectors) out of the read-ahead cache. Only
+* succeeds if every sector is cached. Caller holds the disk lock for unit.
+* 
+* Returns: 1 if the whole range was copied, 0 otherwise
+*/
+int ra_cache_read(int unit, int lba, int sectors, char* buffer){
+	ra_cache_entry* found[RA_CACHE_SECTORS];
+
+	if(sectors<=0 || sectors>RA_CACHE_SECTORS)
+		return 0;
+	for(int i=0; i<sectors; i++){
+		found[i] = NULL;
+		for(int j=0; j<RA_CACHE_SECTORS; j++){
+			if(ra_cache[unit][j].valid && ra_cache[unit][j].lba==lba+i){
+				found[i] = &ra_cache[unit][j];
+				break;
+			}
+		}
+		if(found[i]==NULL)
+			return 0;
+	}
+
+	for(int i=0; i<sectors; i++){
+		memcpy(buffer+i*512, found[i]->data, 512);
+		if(!found[i]->used){
+			found[i]->used = 1;
+			disk_unit_stats[unit].ra_used++;
+		}
+	}
+	disk_unit_stats[unit].ra_cache_hits++;
+	return 1;
+}
+
+/**
+* Moves the sectors read by the unit's finished prefetch into the read-ahead
+* cache, evicting the oldest entries. Caller holds the disk lock for unit.
+*/
+void ra_cache_install(int unit){
+	disk_list_node* node = &ra_node[unit];
+	for(int i=0; i<node->sectors_done; i++){
+		int lba = ra_start_lba[unit] + i;
+		ra_cache_entry* entry = NULL;
+		for(int j=0; j<RA_CACHE_SECTORS; j++){
+			if(ra_cache[unit][j].valid && ra_cache[unit][j].lba==lba){
+				entry = &ra_cache[unit][j];
+				break;
+			}
+		}
+		if(entry==NULL){
+			entry = &ra_cache[unit][ra_cache_next[unit]];
+			ra_cache_next[unit] = (ra_cache_next[unit]+1) % RA_CACHE_SECTORS;
+			if(entry->valid && !entry->used)
+				disk_unit_stats[unit].ra_wasted++;
+		}
+		entry->valid = 1;
+		entry->used = 0;
+		entry->lba = lba;
+		memcpy(entry->data, node->buffer+i*512, 512);
+		disk_unit_stats[unit].ra_prefetched++;
+	}
+}
+
+/**
+* Drops a sector from the read-ahead cache, called before it is written.
+* Caller holds the disk lock for unit.
+*/
+void ra_cache_invalidate(int unit, int lba){
+	for(int j=0; j<RA_CACHE_SECTORS; j++){
+		ra_cache_entry* entry = &ra_cache[unit][j];
+		if(entry->valid && entry->lba==lba){
+			if(!entry->used)
+				disk_unit_stats[unit].ra_wasted++;
+			entry->valid = 0;
+		}
+	}
+}
 
 // Helper Functions
 /////////////////////////////////////////////////////////////////////////////////
+/**
+* Disables interrupts. Wait queues are only touched between this and
+* wait_unlock, which on this single CPU makes a waiter's last look at what
+* it waits for, and blocking, one step no wakeup can come between.
+*
+* Returns: the PSR to give back to wait_unlock
+*/
+unsigned int wait_lock(void){
+	unsigned int psr = USLOSS_PsrGet();
+	USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
+	return psr;
+}
+
+/**
+* Restores the interrupt state saved by wait_lock
+*/
+void wait_unlock(unsigned int psr){
+	USLOSS_PsrSet(psr);
+}
+
+/**
+* Sets up an empty wait queue, kept in key order if ordered is set
+*/
+void wait_queue_init(wait_queue* queue, int ordered){
+	queue->ordered = ordered;
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->waiting = 0;
+	queue->waits = 0;
+	queue->wakeups = 0;
+}
+
+/**
+* Blocks the current process on a queue until it is woken
+*
+* Returns: the status given by the waker
+*/
+int wait_on(wait_queue* queue, long key){
+	return wait_on_unless(queue, key, NULL, NULL);
+}
+
+/**
+* Blocks the current process on a queue until it is woken, unless
+* ready(arg) says what it waits for has already happened. ready is called
+* with interrupts off and must not block.
+*
+* Returns: the status given by the waker, 0 if the process did not block
+*/
+int wait_on_unless(wait_queue* queue, long key, int (*ready)(void*), void* arg){
+	unsigned int psr = wait_lock();
+	if(ready!=NULL && ready(arg)){
+		wait_unlock(psr);
+		return 0;
+	}
+
+	wait_entry entry;
+	entry.pid = getpid();
+	entry.key = key;
+	entry.status = 0;
+	entry.next = NULL;
+	if(queue->tail==NULL){
+		queue->head = &entry;
+		queue->tail = &entry;
+	}
+	else if(!queue->ordered || queue->tail->key <= key){
+		queue->tail->next = &entry;
+		queue->tail = &entry;
+	}
+	else if(key < queue->head->key){
+		entry.next = queue->head;
+		queue->head = &entry;
+	}
+	else{
+		wait_entry* curr = queue->head;
+		while(curr->next->key <= key)
+			curr = curr->next;
+		entry.next = curr->next;
+		curr->next = &entry;
+	}
+	queue->waiting++;
+	queue->waits++;
+	wait_blocks++;
+
+	blockMe(WAIT_BLOCK_STATUS);
+	wait_unlock(psr);
+	return entry.status;
+}
+
+/**
+* Returns 1 if an int flag is set, for waiting on one with wait_on_unless
+*/
+int wait_flag_set(void* flag){
+	return *(int*)flag != 0;
+}
+
+/**
+* Wakes the first process on a queue
+*
+* Returns: the number of processes woken, 0 or 1
+*/
+int wake_one(wait_queue* queue, int status){
+	unsigned int psr = wait_lock();
+	wait_entry* woken = queue->head;
+	if(woken!=NULL){
+		queue->head = woken->next;
+		if(queue->head==NULL)
+			queue->tail = NULL;
+		woken->next = NULL;
+		queue->waiting--;
+		queue->wakeups++;
+	}
+	wait_unlock(psr);
+	wait_unblock(woken, status);
+	return woken!=NULL;
+}
+
+/**
+* Wakes every process on a queue
+*
+* Returns: the number of processes woken
+*/
+int wake_all(wait_queue* queue, int status){
+	return wake_if(queue, NULL, NULL, status);
+}
+
+/**
+* Wakes the processes at the front of an ordered queue whose key is at most
+* key, e.g. those whose deadline has passed
+*
+* Returns: the number of processes woken
+*/
+int wake_until(wait_queue* queue, long key, int status){
+	unsigned int psr = wait_lock();
+	wait_entry* woken = queue->head;
+	wait_entry* last = NULL;
+	int count = 0;
+	while(queue->head!=NULL && queue->ordered && queue->head->key <= key){
+		last = queue->head;
+		queue->head = last->next;
+		count++;
+	}
+	if(last!=NULL)
+		last->next = NULL;
+	else
+		woken = NULL;
+	if(queue->head==NULL)
+		queue->tail = NULL;
+	queue->waiting -= count;
+	queue->wakeups += count;
+	wait_unlock(psr);
+	wait_unblock(woken, status);
+	return count;
+}
+
+/**
+* Wakes the processes on a queue whose entry match(entry, arg) accepts, or
+* all of them if match is NULL. match is called with interrupts off.
+*
+* Returns: the number of processes woken
+*/
+int wake_if(wait_queue* queue, int (*match)(wait_entry*, void*), void* arg, int status){
+	unsigned int psr = wait_lock();
+	wait_entry* woken = NULL;
+	wait_entry** woken_tail = &woken;
+	wait_entry** link = &queue->head;
+	int count = 0;
+	queue->tail = NULL;
+	while(*link!=NULL){
+		wait_entry* entry = *link;
+		if(match==NULL || match(entry, arg)){
+			*link = entry->next;
+			entry->next = NULL;
+			*woken_tail = entry;
+			woken_tail = &entry->next;
+			count++;
+		}
+		else{
+			queue->tail = entry;
+			link = &entry->next;
+		}
+	}
+	queue->waiting -= count;
+	queue->wakeups += count;
+	wait_unlock(psr);
+	wait_unblock(woken, status);
+	return count;
+}
+
+/**
+* Wakes the processes on a queue that are waiting with a given key
+*
+* Returns: the number of processes woken
+*/
+int wake_key(wait_queue* queue, long key, int status){
+	return wake_if(queue, wait_key_equal, &key, status);
+}
+
+/**
+* wake_if match for wake_key
+*/
+int wait_key_equal(wait_entry* entry, void* key){
+	return entry->key == *(long*)key;
+}
+
+/**
+* Unblocks a list of processes taken off a queue, with interrupts back on.
+* Each entry is on its process's stack, so it is not looked at again once
+* that process can run.
+*/
+void wait_unblock(wait_entry* woken, int status){
+	while(woken!=NULL){
+		wait_entry* next = woken->next;
+		int pid = woken->pid;
+		woken->status = status;
+		wait_wakeups++;
+		unblockProc(pid);
+		woken = next;
+	}
+}
+
 /**
 * Acquire lock for disk0 queue
 */
@@ -923,70 +3725,174 @@ void disk_unlock1(){
 
 
 /**
-* Acquire lock for track_count0
+* Returns the phase 4 data of a process, resetting the slot if it last
+* belonged to another process
 */
-void track_count_lock0(){
-	void* empty_message = "";
-	MboxSend(track_count0_mutex_mailbox_num, empty_message, 0);
+proc_data* proc_get(int pid){
+	proc_data* proc = &procs[pid % MAXPROC];
+	if(proc->pid!=pid){
+		memset(proc, 0, sizeof(proc_data));
+		proc->pid = pid;
+		proc->priority = proc_new_priority(pid);
+	}
+	return proc;
 }
 
 /**
-* Release lock for track_count0
+* Returns the priority a process was spawned with, or DEFAULT_PRIORITY if
+* it was not created through Spawn
 */
-void track_count_unlock0(){	
-	void* empty_message = "";
-	MboxRecv(track_count0_mutex_mailbox_num, empty_message, 0);
+int proc_get_priority(int pid){
+	proc_data* proc = proc_find(pid);
+	if(proc==NULL)
+		return proc_new_priority(pid);
+	return proc->priority;
+}
+
+/**
+* Returns the priority of a process with no data recorded yet. One that
+* shows up while a spawn is in progress is the child of the innermost
+* spawn, which is running ahead of its parent.
+*/
+int proc_new_priority(int pid){
+	if(spawn_depth>0 && spawns[spawn_depth-1].parent!=pid)
+		return spawns[spawn_depth-1].priority;
+	return DEFAULT_PRIORITY;
+}
+
+/**
+* Returns the phase 4 data of a process, or NULL if none has been recorded
+*/
+proc_data* proc_find(int pid){
+	proc_data* proc = &procs[pid % MAXPROC];
+	if(proc->pid!=pid)
+		return NULL;
+	return proc;
+}
+
+/**
+* Wakes an idle disk daemon after an operation has been dispatched to it,
+* by issuing a cheap request whose interrupt gets it going
+*/
+void disk_kick(int unit){
+	// Need to wait until the daemon has probed the unit, so its probe
+	// doesn't "steal" the interrupt of the operation we are sending
+	disk_wait_probe(unit);
+	disk_poke(unit);
 }
 
+/**
+* Sends an idle, probed unit a dummy operation, so its daemon wakes up and
+* looks at the queues again. Doesn't block.
+*/
+void disk_poke(int unit){
+	static int num[2];
+	USLOSS_DeviceRequest req;
+	req.opr = USLOSS_DISK_TRACKS;
+	req.reg1 = (void*)&num[unit];
+	USLOSS_DeviceOutput(USLOSS_DISK_DEV, unit, &req);
+}
 
 /**
-* Acquire lock for track_count1
+* Acquire lock for the mirrored unit's resync state
 */
-void track_count_lock1(){
+void mirror_lock(){
 	void* empty_message = "";
-	MboxSend(track_count1_mutex_mailbox_num, empty_message, 0);
+	if(MboxCondSend(mirror_mutex_mailbox_num, empty_message, 0)!=0)
+		lock_wait(mirror_mutex_mailbox_num);
 }
 
 /**
-* Release lock for track_count1
+* Release lock for the mirrored unit's resync state
 */
-void track_count_unlock1(){	
+void mirror_unlock(){
 	void* empty_message = "";
-	MboxRecv(track_count1_mutex_mailbox_num, empty_message, 0);
+	MboxRecv(mirror_mutex_mailbox_num, empty_message, 0);
 }
 
+/**
+* Acquire lock for the DiskCopy buffers
+*/
+void disk_copy_lock(){
+	void* empty_message = "";
+	if(MboxCondSend(disk_copy_mutex_mailbox_num, empty_message, 0)!=0)
+		lock_wait(disk_copy_mutex_mailbox_num);
+}
 
 /**
-* Acquire lock for track_list0
+* Release lock for the DiskCopy buffers
 */
-void track_list_lock0(){
+void disk_copy_unlock(){
 	void* empty_message = "";
-	MboxSend(track_list0_mutex_mailbox_num, empty_message, 0);
+	MboxRecv(disk_copy_mutex_mailbox_num, empty_message, 0);
 }
 
 /**
-* Release lock for track_list0
+* Acquire lock for the queue of a given disk
 */
-void track_list_unlock0(){	
+void disk_lock(int unit){
 	void* empty_message = "";
-	MboxRecv(track_list0_mutex_mailbox_num, empty_message, 0);
+	int mailbox_num = unit==0 ? disk0_mutex_mailbox_num : disk1_mutex_mailbox_num;
+	if(MboxCondSend(mailbox_num, empty_message, 0)!=0)
+		lock_wait(mailbox_num);
 }
 
+/**
+* Gets lock for asynchronous terminal requests and completion queues
+*/
+void term_async_lock(){
+	void* empty_message = "";
+	MboxSend(term_async_mutex_mailbox_num, empty_message, 0);
+}
 
 /**
-* Acquire lock for track_list1
+* Release lock for asynchronous terminal requests and completion queues
 */
-void track_list_lock1(){
+void term_async_unlock(){
 	void* empty_message = "";
-	MboxSend(track_list1_mutex_mailbox_num, empty_message, 0);
+	MboxRecv(term_async_mutex_mailbox_num, empty_message, 0);
 }
 
 /**
-* Release lock for track_list1
+* Takes a mailbox lock that another process holds, charging the time spent
+* waiting to the caller's lock_time. Only called once the lock was found
+* taken, so an uncontended lock costs no clock reads.
 */
-void track_list_unlock1(){	
+void lock_wait(int mailbox_num){
 	void* empty_message = "";
-	MboxRecv(track_list1_mutex_mailbox_num, empty_message, 0);
+	int start = currentTime();
+	MboxSend(mailbox_num, empty_message, 0);
+	int waited = currentTime() - start;
+	proc_get(getpid())->io.lock_time += waited;
+	lock_waits++;
+	lock_wait_time += waited;
+}
+
+/**
+* Release lock for the queue of a given disk
+*/
+void disk_unlock(int unit){
+	if(unit==0)
+		disk_unlock0();
+	else
+		disk_unlock1();
+}
+
+/**
+* Returns the queue head of a given disk. Caller holds its disk lock.
+*/
+disk_list_node** disk_queue(int unit){
+	if(unit==0)
+		return &disk_list0;
+	return &disk_list1;
+}
+
+/**
+* Returns the number of tracks of a given disk, or -1 if not known yet.
+* Needs no lock: the count is written once, when the unit is probed.
+*/
+int disk_track_count(int unit){
+	return __atomic_load_n(&sys_info_block.disks[unit].tracks, __ATOMIC_ACQUIRE);
 }
 
 /** 
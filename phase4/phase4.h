@@ -7,6 +7,268 @@
 
 #define MAXLINE         80
 
+/*
+ * System call numbers for the phase 4 extensions. These sit above the ones
+ * in usyscall.h and below MAXSYSCALLS.
+ */
+#define SYS_DISKSTATS   30
+#define SYS_DISKSETLIMIT 31
+#define SYS_DISKGETLIMIT 32
+#define SYS_DISKRESYNC  33
+#define SYS_DISKTRACE   34
+#define SYS_KTRACE      35
+#define SYS_PROCIO      36
+#define SYS_PROFILE     37
+#define SYS_TERMCQCREATE 38
+#define SYS_TERMREADASYNC 39
+#define SYS_TERMWRITEASYNC 40
+#define SYS_TERMCOMPLETE 41
+#define SYS_BATCH       42
+#define SYS_IO_SETUP    43
+#define SYS_IO_ENTER    44
+#define SYS_DISKCOPY    45
+#define SYS_DISKFILL    46
+#define SYS_TERMCQRELEASE 47
+
+/*
+ * Logical disk unit mirroring units 0 and 1 (RAID-1). DiskRead, DiskWrite
+ * and DiskSize accept it like a physical unit.
+ */
+#define DISK_MIRROR_UNIT 10
+
+/*
+ * Logical disk unit striping tracks across units 0 and 1 (RAID-0): even
+ * tracks are on unit 0 and odd tracks on unit 1.
+ */
+#define DISK_STRIPE_UNIT 11
+
+/*
+ * Geometry of a physical disk unit, found out when its daemon probes it at
+ * boot. tracks is -1 until then, and nothing changes after.
+ */
+typedef struct disk_geometry {
+    int sector_size;         // bytes in a sector
+    int sectors_per_track;
+    int tracks;              // -1 until the unit has been probed
+} disk_geometry;
+
+/*
+ * Information the kernel publishes for the user library to read in place,
+ * without a system call. Read-only outside the kernel; see sys_info_page.
+ */
+typedef struct sys_info {
+    disk_geometry disks[2];  // units 0 and 1
+    int term_units;          // number of terminals
+    int clock_tick_us;       // length of the clock tick Sleep() counts in
+} sys_info;
+
+extern const sys_info *sys_info_page;
+
+/*
+ * Per-unit disk statistics, filled in by DiskStats().
+ */
+typedef struct disk_stats {
+    int reads;               // read requests completed
+    int writes;              // write requests completed
+    long read_latency_total; // sum over reads of arrival to completion (us)
+    long write_latency_total;// sum over writes of arrival to completion (us)
+    int read_latency_max;    // slowest read (us)
+    int write_latency_max;   // slowest write (us)
+    int ra_cache_hits;       // read requests served entirely from read-ahead cache
+    int ra_prefetched;       // sectors prefetched into the read-ahead cache
+    int ra_used;             // prefetched sectors later handed to a reader
+    int ra_wasted;           // prefetched sectors evicted/invalidated unused
+    int ra_window;           // read-ahead window (sectors) of the last sequential stream
+    int fill_merged;         // fill requests merged into a waiting one
+} disk_stats;
+
+/*
+ * Disk bandwidth limits of a process and their effect, filled in by
+ * DiskGetLimit().
+ */
+typedef struct disk_qos {
+    int sector_rate;         // sectors per second, 0 for no limit
+    int op_rate;             // operations per second, 0 for no limit
+    long throttled_time;     // total time requests waited for tokens (us)
+    int throttled_ops;       // requests that had to wait for tokens
+} disk_qos;
+
+/*
+ * Disk trace, read with DiskTrace(). Each unit keeps its last
+ * DISK_TRACE_RECORDS events in a ring of fixed-size records.
+ */
+#define DISK_TRACE_RECORDS 256
+
+#define DISK_TRACE_ARRIVE     1  // request queued; arg: sectors
+#define DISK_TRACE_DISPATCH   2  // request picked to run; arg: 1 if piggybacked
+#define DISK_TRACE_SEEK       3  // seek issued; arg: track
+#define DISK_TRACE_SECTOR     4  // sector transfer issued; arg: sector of the request
+#define DISK_TRACE_COMPLETE   5  // request finished; arg: device status
+#define DISK_TRACE_CACHE_HIT  6  // read served from read-ahead cache; arg: sectors
+#define DISK_TRACE_PREFETCH   7  // read-ahead started; arg: sectors
+#define DISK_TRACE_MERGE      8  // fill merged into a waiting one; arg: that one's id
+
+typedef struct disk_trace_record {
+    int time;                // currentTime() of the event (us)
+    int event;               // DISK_TRACE_*
+    int pid;                 // process the request belongs to
+    int id;                  // request, numbered per unit when it arrives
+    int operation;           // 0 read, 1 write
+    int track;               // request's track when the event happened
+    int block;               // request's next block when the event happened
+    int arg;                 // event specific, see above
+} disk_trace_record;
+
+/*
+ * Per-process I/O accounting, filled in by ProcIO(). Time is in us.
+ *
+ *   disk_read/disk_write: queued is arrival to dispatch and service is
+ *     dispatch to completion, summed over every piece a request was split
+ *     into; reads served from the read-ahead cache add neither
+ *   term_read: queued is time blocked waiting for a line
+ *   term_write: queued is time blocked until term_daemon took the line
+ *   sleep: queued is time asleep; bytes is unused
+ */
+typedef struct proc_io_counters {
+    int ops;
+    long bytes;
+    long queued_time;
+    long service_time;
+} proc_io_counters;
+
+typedef struct proc_io {
+    proc_io_counters disk_read;
+    proc_io_counters disk_write;
+    proc_io_counters term_read;
+    proc_io_counters term_write;
+    proc_io_counters sleep;
+    long lock_time;          // blocked on a disk or mirror lock held by another process
+} proc_io;
+
+/*
+ * Asynchronous terminal I/O. TermReadAsync() and TermWriteAsync() return at
+ * once; when the line has been read or written, a term_completion is put
+ * on the completion queue named in the call, to be taken with
+ * TermComplete(). A queue holds up to TERM_ASYNC_MAX completions and no
+ * more requests than that can be outstanding on it. It is freed by
+ * TermCompletionQueueRelease(), or when the process that made it quits;
+ * requests still waiting on it are then dropped.
+ */
+#define TERM_ASYNC_MAX 32
+
+#define TERM_ASYNC_READ  0
+#define TERM_ASYNC_WRITE 1
+
+typedef struct term_completion {
+    int tag;                 // as passed to TermReadAsync()/TermWriteAsync()
+    int operation;           // TERM_ASYNC_READ or TERM_ASYNC_WRITE
+    int unit;                // terminal
+    int count;               // characters read or written
+} term_completion;
+
+/*
+ * System call batches: Batch() runs up to BATCH_MAX phase 4 system calls in
+ * one trap. Each entry is filled in like the USLOSS_Sysargs the call's own
+ * wrapper would pass, and gets that call's outputs back.
+ */
+#define BATCH_MAX 64
+
+/*
+ * Submission and completion rings shared by a process and the kernel. The
+ * process registers an io_ring with IoSetup(), fills io_sqe entries at
+ * sq_tail and takes io_cqe entries at cq_head; one IoEnter() hands the
+ * kernel the entries added since the last one and can wait for
+ * completions, which the daemons post straight into cq. The counters only
+ * grow; entry n is at index n % IO_RING_ENTRIES. No more than
+ * IO_RING_ENTRIES requests are ever in flight or completed but not taken,
+ * so cq cannot overflow. A ring stays registered until its process quits;
+ * its terminal requests and timeouts are then cancelled.
+ */
+#define IO_RING_ENTRIES 32
+
+#define IO_OP_DISK_READ  0
+#define IO_OP_DISK_WRITE 1
+#define IO_OP_TERM_READ  2
+#define IO_OP_TERM_WRITE 3
+#define IO_OP_TIMEOUT    4
+
+typedef struct io_sqe {
+    int opcode;              // IO_OP_*
+    int unit;                // disk unit or terminal
+    void *buffer;            // must stay valid until completion, except for a terminal write
+    int length;              // disk: sectors; terminal: size of buffer or line; timeout: clock ticks
+    int track;               // disk: starting track
+    int first;               // disk: starting block
+    long user_data;          // handed back in the completion
+} io_sqe;
+
+typedef struct io_cqe {
+    long user_data;
+    int result;              // disk: 0 or the disk status register; terminal: characters
+                             // read or written; timeout: 0; -1 for an invalid or
+                             // cancelled request
+} io_cqe;
+
+typedef struct io_ring {
+    unsigned int sq_head;    // next entry the kernel takes
+    unsigned int sq_tail;    // next entry the process fills
+    unsigned int cq_head;    // next completion the process takes
+    unsigned int cq_tail;    // next completion the kernel posts
+    io_sqe sq[IO_RING_ENTRIES];
+    io_cqe cq[IO_RING_ENTRIES];
+} io_ring;
+
+/*
+ * Clock-tick CPU profile, controlled with Profile(). While it runs, every
+ * clock interrupt charges one sample to the process it interrupted.
+ */
+#define PROFILE_START 1          // clear the profile and start sampling
+#define PROFILE_STOP  2          // stop sampling, keeping the samples
+#define PROFILE_DUMP  3          // copy the samples out
+
+typedef struct profile_sample {
+    int pid;
+    int user_samples;        // ticks that found the process in user mode
+    int kernel_samples;      // ticks that found it in the kernel
+} profile_sample;
+
+/*
+ * Kernel event trace, read with KTrace(). Sleep, disk and terminal paths each
+ * keep their last KTRACE_RECORDS events. Tracepoints are only compiled into
+ * the kernel for the subsystems in KTRACE_MASK (see phase4.c); by default
+ * there are none and the rings stay empty.
+ */
+#define KTRACE_SLEEP      0
+#define KTRACE_DISK       1
+#define KTRACE_TERM       2
+#define KTRACE_SUBSYSTEMS 3
+
+#define KTRACE_RECORDS 256
+
+#define KTRACE_SLEEP_ENTER      1   // Sleep() called; arg1: seconds, arg2: wake-up tick
+#define KTRACE_SLEEP_WAKE       2   // a sleeper was woken; arg1: its pid, arg2: tick
+#define KTRACE_SLEEP_RETURN     3   // Sleep() returns; arg1: seconds, arg2: ticks late
+#define KTRACE_DISK_READ        4   // DiskRead() called; arg1: unit, arg2: track
+#define KTRACE_DISK_WRITE       5   // DiskWrite() called; arg1: unit, arg2: track
+#define KTRACE_DISK_DONE        6   // DiskRead()/DiskWrite() returns; arg1: unit, arg2: status
+#define KTRACE_DISK_INTERRUPT   7   // disk_daemon woken by the device; arg1: unit, arg2: status
+#define KTRACE_TERM_READ        8   // TermRead() called; arg1: terminal, arg2: buffer size
+#define KTRACE_TERM_READ_DONE   9   // TermRead() returns; arg1: terminal, arg2: characters
+#define KTRACE_TERM_WRITE      10   // TermWrite() called; arg1: terminal, arg2: characters
+#define KTRACE_TERM_WRITE_DONE 11   // TermWrite() returns; arg1: terminal, arg2: characters
+#define KTRACE_TERM_LINE_IN    12   // term_daemon queued an input line; arg1: terminal, arg2: length
+#define KTRACE_TERM_LINE_DROP  13   // input line lost, buffers full; arg1: terminal, arg2: length
+#define KTRACE_TERM_LINE_OUT   14   // term_daemon sent a line; arg1: terminal, arg2: length
+
+typedef struct ktrace_record {
+    int time;                // currentTime() of the event (us)
+    int seq;                 // position in the subsystem's trace, from 1
+    int event;               // KTRACE_*
+    int pid;                 // process that hit the tracepoint
+    int arg1;                // event specific, see above
+    int arg2;
+} ktrace_record;
+
 extern void phase4_init(void);
 
 #endif /* _PHASE4_H */
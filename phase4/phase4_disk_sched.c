@@ -0,0 +1,265 @@
+/*
+ * Disk request scheduling policy for phase 4. See phase4_disk_sched.h.
+ */
+
+#include <stdlib.h>
+#include "phase4_disk_sched.h"
+
+/**
+* Looks for a waiting request that lies entirely on the track the head is
+* on (the track curr just finished) and does not touch curr's data, and
+* moves it to the front of the unit's list, ahead of curr. Reads are looked
+* at before writes. Caller holds the disk lock for unit and curr is the
+* head of the list.
+* 
+* Returns: the request moved to the front, or NULL if there is none
+*/
+disk_list_node* disk_take_same_track(int unit, disk_list_node* curr){
+	disk_list_node** queues[2] = { &disk_read_queue[unit], &disk_write_queue[unit] };
+	int now = currentTime();
+	for(int i=0; i<2; i++){
+		disk_list_node** link = queues[i];
+		while(*link!=NULL){
+			disk_list_node* node = *link;
+			if(node->track==curr->track && node->sectors>0 &&
+					node->start_block+node->sectors<=16 && !disk_conflict(curr, node) &&
+					disk_qos_ready(node, now)){
+				disk_qos_charge(node, now);
+				node->dispatch_time = now;
+				disk_trace(unit, DISK_TRACE_DISPATCH, node, 1);
+				*link = node->next;
+				node->next = curr;
+				*disk_queue(unit) = node;
+				return node;
+			}
+			link = &node->next;
+		}
+	}
+	return NULL;
+}
+
+/**
+* Adds an operation to the end of a waiting queue. Caller holds the disk lock.
+*/
+void disk_queue_append(disk_list_node** queue, disk_list_node* node){
+	node->next = NULL;
+	while(*queue!=NULL)
+		queue = &(*queue)->next;
+	*queue = node;
+}
+
+/**
+* Picks the next operation for an idle unit and makes it the head of the
+* unit's list. The most urgent priority class waiting goes first (see
+* disk_class). If reads and writes of the same class are waiting, reads are
+* favoured: up to DISK_READ_BATCH of them go in a row while writes wait,
+* then up to DISK_WRITE_BATCH writes. A write older than DISK_WRITE_EXPIRE
+* goes next no matter what, that write itself rather than the C-SCAN pick. Within the chosen queue and class the order is
+* C-SCAN from the current head position. Caller holds the disk lock for unit.
+* 
+* Returns: the dispatched operation, or NULL if nothing is waiting
+*/
+disk_list_node* disk_dispatch(int unit){
+	int now = currentTime();
+	int read_class = disk_best_class(disk_read_queue[unit], now);
+	int write_class = disk_best_class(disk_write_queue[unit], now);
+	disk_list_node** expired = NULL;
+	int op;
+
+	if(read_class<0 && write_class<0){
+		// Anything still waiting is over its limit
+		disk_stalled[unit] = disk_read_queue[unit]!=NULL || disk_write_queue[unit]!=NULL;
+		return NULL;
+	}
+	disk_stalled[unit] = 0;
+
+	if(write_class<0)
+		op = READ;
+	else if(read_class<0)
+		op = WRITE;
+	else if((expired = disk_write_expired(&disk_write_queue[unit], now))!=NULL)
+		op = WRITE;
+	else if(read_class!=write_class)
+		op = read_class<write_class ? READ : WRITE;
+	else if(disk_batch_op[unit]==READ)
+		op = disk_batch_count[unit]<DISK_READ_BATCH ? READ : WRITE;
+	else
+		op = disk_batch_count[unit]<DISK_WRITE_BATCH ? WRITE : READ;
+
+	if(op!=disk_batch_op[unit]){
+		disk_batch_op[unit] = op;
+		disk_batch_count[unit] = 0;
+	}
+	disk_batch_count[unit]++;
+
+	disk_list_node* node;
+	if(expired!=NULL){
+		node = *expired;
+		*expired = node->next;
+		node->next = NULL;
+	}
+	else if(op==READ)
+		node = disk_cscan_take(&disk_read_queue[unit], disk_head_track[unit], read_class, now);
+	else
+		node = disk_cscan_take(&disk_write_queue[unit], disk_head_track[unit], write_class, now);
+	disk_qos_charge(node, now);
+	node->dispatch_time = now;
+	disk_trace(unit, DISK_TRACE_DISPATCH, node, 0);
+	node->next = *disk_queue(unit);
+	*disk_queue(unit) = node;
+	return node;
+}
+
+/**
+* Returns the priority class of a waiting operation: the priority of the
+* process that issued it, less one class for every DISK_AGING_INTERVAL it
+* has waited, so low priority I/O cannot be held back forever. 1 is the
+* most urgent.
+*/
+int disk_class(disk_list_node* node, int now){
+	int class = proc_get_priority(node->pid) - (now - node->queued_time)/DISK_AGING_INTERVAL;
+	if(class < 1)
+		class = 1;
+	return class;
+}
+
+/**
+* Returns the most urgent class waiting in a queue, or -1 if nothing in it
+* can be dispatched
+*/
+int disk_best_class(disk_list_node* queue, int now){
+	int best = -1;
+	for(disk_list_node* node = queue; node!=NULL; node = node->next){
+		if(!disk_qos_ready(node, now))
+			continue;
+		int class = disk_class(node, now);
+		if(best<0 || class<best)
+			best = class;
+	}
+	return best;
+}
+
+/**
+* Removes the operation C-SCAN would serve next among those of a given
+* class in a waiting queue that are within their process's limits: the
+* lowest track at or beyond the head, wrapping
+* around to the lowest track overall. Ties go to the one that arrived first.
+*/
+disk_list_node* disk_cscan_take(disk_list_node** queue, int head_track, int class, int now){
+	disk_list_node** ahead = NULL;
+	disk_list_node** lowest = NULL;
+	for(disk_list_node** link = queue; *link!=NULL; link = &(*link)->next){
+		if(!disk_qos_ready(*link, now) || disk_class(*link, now)!=class)
+			continue;
+		int track = (*link)->track;
+		if(track>=head_track && (ahead==NULL || track<(*ahead)->track))
+			ahead = link;
+		if(lowest==NULL || track<(*lowest)->track)
+			lowest = link;
+	}
+	disk_list_node** link = ahead!=NULL ? ahead : lowest;
+	disk_list_node* node = *link;
+	*link = node->next;
+	node->next = NULL;
+	return node;
+}
+
+/**
+* Finds the oldest write in a waiting queue that has waited DISK_WRITE_EXPIRE
+* or more and is within its process's limits. The queue is in arrival order.
+*
+* Returns: the link to it, or NULL if there is none
+*/
+disk_list_node** disk_write_expired(disk_list_node** queue, int now){
+	for(disk_list_node** link = queue; *link!=NULL; link = &(*link)->next){
+		if(now - (*link)->queued_time < DISK_WRITE_EXPIRE)
+			return NULL;
+		if(disk_qos_ready(*link, now))
+			return link;
+	}
+	return NULL;
+}
+
+/**
+* Checks a waiting operation against its process's token buckets. An
+* operation may go while both buckets are non-negative; a large request can
+* drive them into debt, which later refills pay off. Caller holds the disk
+* lock.
+*
+* Returns: 1 if the operation can be dispatched now, 0 if it is throttled
+*/
+int disk_qos_ready(disk_list_node* node, int now){
+	proc_data* proc = proc_find(node->pid);
+	if(proc==NULL)
+		return 1;
+	int throttled = (proc->sector_rate>0 && proc->sector_credit<0)
+		|| (proc->op_rate>0 && proc->op_credit<0);
+	if(!throttled)
+		return 1;
+
+	if(node->throttled_since==0){
+		node->throttled_since = now;
+		proc->throttled_ops++;
+	}
+	return 0;
+}
+
+/**
+* Takes the tokens for an operation that is being dispatched, and adds any
+* time it spent throttled to its process's total. Caller holds the disk lock;
+* the credits are taken atomically because sleep_daemon refills them without it.
+*/
+void disk_qos_charge(disk_list_node* node, int now){
+	proc_data* proc = proc_find(node->pid);
+	if(proc==NULL)
+		return;
+	if(proc->sector_rate>0)
+		__atomic_sub_fetch(&proc->sector_credit, node->sectors*1000L, __ATOMIC_RELAXED);
+	if(proc->op_rate>0)
+		__atomic_sub_fetch(&proc->op_credit, 1000, __ATOMIC_RELAXED);
+	if(node->throttled_since!=0){
+		proc->throttled_time += now - node->throttled_since;
+		node->throttled_since = 0;
+	}
+}
+
+/**
+* Checks whether two operations touch a common sector and at least one of
+* them is a write, so their order matters for the data.
+*/
+int disk_conflict(disk_list_node* a, disk_list_node* b){
+	if(a->operation==READ && b->operation==READ)
+		return 0;
+	// A started operation has moved past sectors_done of its sectors
+	int a_start = a->track*16 + a->start_block - a->sectors_done;
+	int b_start = b->track*16 + b->start_block - b->sectors_done;
+	return a_start < b_start+b->sectors && b_start < a_start+a->sectors;
+}
+
+/**
+* Folds a fill into a waiting fill from the same pattern block that it
+* continues, or that continues it, so both are written as one transfer.
+* The waiting request grows to cover the two; it is scheduled and charged
+* for both, and the merged one finishes with it. Caller holds the disk lock.
+*
+* Returns: the request node was merged into; NULL if it has to be queued itself
+*/
+disk_list_node* disk_fill_merge(disk_list_node* queue, disk_list_node* node){
+	int first = node->track*16 + node->start_block;
+	for(disk_list_node* lead = queue; lead!=NULL; lead = lead->next){
+		if(!lead->fill || lead->buffer!=node->buffer)
+			continue;
+		int lead_first = lead->track*16 + lead->start_block;
+		if(first + node->sectors == lead_first){
+			lead->track = node->track;
+			lead->start_block = node->start_block;
+		}
+		else if(lead_first + lead->sectors != first)
+			continue;
+		lead->sectors += node->sectors;
+		node->merged = lead->merged;
+		lead->merged = node;
+		return lead;
+	}
+	return NULL;
+}
@@ -0,0 +1,105 @@
+/*
+ * Disk request scheduling for phase 4: the queue node, the policy that
+ * picks the next request for a unit, and the per-process limits it obeys.
+ *
+ * The policy code in phase4_disk_sched.c only touches the state declared
+ * here, so it is shared by the kernel (phase4.c) and the offline simulator
+ * (tools/disksim.c), which each provide the state and the hooks at the end
+ * of this file.
+ */
+
+#ifndef _PHASE4_DISK_SCHED_H
+#define _PHASE4_DISK_SCHED_H
+
+#include "phase4.h"
+
+#define READ 0
+#define WRITE 1
+
+// Same-track requests served per track boundary of a multi-track transfer
+#define DISK_PIGGYBACK_MAX 4
+
+// Read/write dispatch policy: reads dispatched in a row while writes wait,
+// writes dispatched in a row once it is their turn, and how long (us) a
+// write may wait before it goes ahead of reads regardless. Fixed at build
+// time; override with e.g. -DDISK_WRITE_EXPIRE=200000.
+#ifndef DISK_READ_BATCH
+#define DISK_READ_BATCH 8
+#endif
+#ifndef DISK_WRITE_BATCH
+#define DISK_WRITE_BATCH 4
+#endif
+#ifndef DISK_WRITE_EXPIRE
+#define DISK_WRITE_EXPIRE 500000
+#endif
+
+// Waiting time (us) after which a disk request moves up one priority class
+#define DISK_AGING_INTERVAL 50000
+
+// Priority assumed for processes not started through Spawn
+#define DEFAULT_PRIORITY 3
+
+typedef struct disk_list_node{
+	int pid;
+	int id;                     // trace id, given when it arrives at a unit
+	int started;
+	struct disk_done* done;     // kernel: what the caller waits on, NULL for prefetches
+	char* buffer;
+	int track;
+	int sectors;
+	int sectors_done;
+	int start_block;
+	int operation;
+	int response_status;
+	int prefetch;
+	int piggybacks;
+	int queued_time;
+	int dispatch_time;
+	int complete_time;
+	int throttled_since;
+	int fill;                   // buffer is one sector, written to every sector
+	struct disk_list_node* merged; // fills that finish with this one
+	struct disk_list_node* next;
+}disk_list_node;
+
+typedef struct proc_data {
+	int pid;
+	int priority;
+	int sector_rate;       // disk sectors per second, 0 for no limit
+	int op_rate;           // disk operations per second, 0 for no limit
+	long sector_credit;    // token buckets, in thousandths of a sector/op
+	long op_credit;
+	long throttled_time;   // us that dispatchable requests were held back
+	int throttled_ops;     // requests that had to wait for tokens
+	proc_io io;            // what the process has done and waited for
+} proc_data;
+
+// Scheduler state, per unit
+extern disk_list_node* disk_read_queue[2];
+extern disk_list_node* disk_write_queue[2];
+extern int disk_batch_op[2];
+extern int disk_batch_count[2];
+extern int disk_head_track[2];
+extern int disk_stalled[2];
+
+// Policy, in phase4_disk_sched.c
+disk_list_node* disk_take_same_track(int unit, disk_list_node* curr);
+void disk_queue_append(disk_list_node** queue, disk_list_node* node);
+disk_list_node* disk_dispatch(int unit);
+disk_list_node* disk_cscan_take(disk_list_node** queue, int head_track, int class, int now);
+disk_list_node** disk_write_expired(disk_list_node** queue, int now);
+int disk_class(disk_list_node* node, int now);
+int disk_best_class(disk_list_node* queue, int now);
+int disk_qos_ready(disk_list_node* node, int now);
+void disk_qos_charge(disk_list_node* node, int now);
+int disk_conflict(disk_list_node* a, disk_list_node* b);
+disk_list_node* disk_fill_merge(disk_list_node* queue, disk_list_node* node);
+
+// Hooks provided by whoever links the policy in
+extern int currentTime(void);
+disk_list_node** disk_queue(int unit);
+proc_data* proc_find(int pid);
+int proc_get_priority(int pid);
+void disk_trace(int unit, int event, disk_list_node* node, int arg);
+
+#endif /* _PHASE4_DISK_SCHED_H */
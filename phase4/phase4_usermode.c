@@ -8,6 +8,7 @@
 #include <usloss.h>
 #include <usyscall.h>
 
+#include "phase4.h"
 #include "phase4_usermode.h"
 
 #define CHECKMODE { \
@@ -190,6 +191,19 @@ int DiskSize(int unit, int *sector, int *track, int *disk)
     USLOSS_Sysargs sysArg;
     
     CHECKMODE;
+
+    /* A probed physical unit is answered from the kernel's info page */
+    if (unit == 0 || unit == 1) {
+        const disk_geometry *geometry = &sys_info_page->disks[unit];
+        int tracks = __atomic_load_n(&geometry->tracks, __ATOMIC_ACQUIRE);
+        if (tracks >= 0) {
+            *sector = geometry->sector_size;
+            *track  = geometry->sectors_per_track;
+            *disk   = tracks;
+            return 0;
+        }
+    }
+
     sysArg.number = SYS_DISKSIZE;
     sysArg.arg1 = (void *) ( (long) unit);
 
@@ -201,4 +215,613 @@ int DiskSize(int unit, int *sector, int *track, int *disk)
     return (long) sysArg.arg4;
 } /* end of DiskSize */
 
+
+/*
+ *  Routine:  SysInfo
+ *
+ *  Description: Returns the information block the kernel publishes for
+ *               user code: disk geometry, terminal count and clock tick.
+ *               It is read in place, without a system call.
+ *
+ *  Arguments:    none
+ *
+ *  Return Value: pointer to the read-only block
+ */
+const sys_info *SysInfo(void)
+{
+    return sys_info_page;
+} /* end of SysInfo */
+
+
+/*
+ *  Routine:  DiskStats
+ *
+ *  Description: This is the call entry point for reading the disk
+ *               statistics kept by the kernel for one unit.
+ *
+ *  Arguments:    int         unit  -- which disk
+ *                disk_stats *stats -- pointer to output value
+ *                (output value: counters for the unit)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskStats(int unit, disk_stats *stats)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_DISKSTATS;
+    sysArg.arg1 = (void *) ( (long) unit);
+    sysArg.arg2 = (void *) stats;
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of DiskStats */
+
+
+/*
+ *  Routine:  DiskSetLimit
+ *
+ *  Description: This is the call entry point for limiting the disk
+ *               bandwidth of a process.
+ *
+ *  Arguments:    int pid           -- process to limit
+ *                int sectorsPerSec -- sectors per second, 0 for no limit
+ *                int opsPerSec     -- operations per second, 0 for no limit
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskSetLimit(int pid, int sectorsPerSec, int opsPerSec)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_DISKSETLIMIT;
+    sysArg.arg1 = (void *) ( (long) pid);
+    sysArg.arg2 = (void *) ( (long) sectorsPerSec);
+    sysArg.arg3 = (void *) ( (long) opsPerSec);
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of DiskSetLimit */
+
+
+/*
+ *  Routine:  DiskGetLimit
+ *
+ *  Description: This is the call entry point for reading the disk
+ *               limits of a process and the time it was throttled.
+ *
+ *  Arguments:    int       pid -- which process
+ *                disk_qos *qos -- pointer to output value
+ *                (output value: limits and throttling counters)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskGetLimit(int pid, disk_qos *qos)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_DISKGETLIMIT;
+    sysArg.arg1 = (void *) ( (long) pid);
+    sysArg.arg2 = (void *) qos;
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of DiskGetLimit */
+
+
+/*
+ *  Routine:  DiskResync
+ *
+ *  Description: This is the call entry point for resynchronizing one
+ *               half of the mirrored disk unit from the other.
+ *
+ *  Arguments:    int  unit   -- half to resync, or -1 to only query
+ *                int *stale0 -- pointer to output value
+ *                int *stale1 -- pointer to output value
+ *                (output values: tracks of units 0 and 1 still out of date)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskResync(int unit, int *stale0, int *stale1)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_DISKRESYNC;
+    sysArg.arg1 = (void *) ( (long) unit);
+
+    USLOSS_Syscall(&sysArg);
+
+    *stale0 = (long) sysArg.arg2;
+    *stale1 = (long) sysArg.arg3;
+    return (long) sysArg.arg4;
+} /* end of DiskResync */
+
+
+/*
+ *  Routine:  DiskTrace
+ *
+ *  Description: This is the call entry point for taking a snapshot of
+ *               a disk unit's trace.
+ *
+ *  Arguments:    int                unit    -- which disk
+ *                disk_trace_record *records -- where to copy the records
+ *                int                max     -- size of records
+ *                int               *count   -- pointer to output value
+ *                int               *lost    -- pointer to output value
+ *                (output values: records copied, oldest first, and how
+ *                 many older ones were overwritten)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskTrace(int unit, disk_trace_record *records, int max,
+              int *count, int *lost)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_DISKTRACE;
+    sysArg.arg1 = (void *) ( (long) unit);
+    sysArg.arg2 = (void *) records;
+    sysArg.arg3 = (void *) ( (long) max);
+
+    USLOSS_Syscall(&sysArg);
+
+    *count = (long) sysArg.arg1;
+    *lost  = (long) sysArg.arg2;
+    return (long) sysArg.arg4;
+} /* end of DiskTrace */
+
+
+/*
+ *  Routine:  KTrace
+ *
+ *  Description: This is the call entry point for taking a snapshot of
+ *               one subsystem's kernel event trace.
+ *
+ *  Arguments:    int            subsystem -- KTRACE_SLEEP, KTRACE_DISK or
+ *                                            KTRACE_TERM
+ *                ktrace_record *records   -- where to copy the records
+ *                int            max       -- size of records
+ *                int           *count     -- pointer to output value
+ *                int           *lost      -- pointer to output value
+ *                (output values: records copied, oldest first, and how
+ *                 many older ones are no longer available)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int KTrace(int subsystem, ktrace_record *records, int max,
+           int *count, int *lost)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_KTRACE;
+    sysArg.arg1 = (void *) ( (long) subsystem);
+    sysArg.arg2 = (void *) records;
+    sysArg.arg3 = (void *) ( (long) max);
+
+    USLOSS_Syscall(&sysArg);
+
+    *count = (long) sysArg.arg1;
+    *lost  = (long) sysArg.arg2;
+    return (long) sysArg.arg4;
+} /* end of KTrace */
+
+
+/*
+ *  Routine:  ProcIO
+ *
+ *  Description: This is the call entry point for reading the I/O
+ *               accounting of a process.
+ *
+ *  Arguments:    int      pid -- process to query, 0 for the caller
+ *                proc_io *io  -- where to copy the counters
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int ProcIO(int pid, proc_io *io)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_PROCIO;
+    sysArg.arg1 = (void *) ( (long) pid);
+    sysArg.arg2 = (void *) io;
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of ProcIO */
+
+
+/*
+ *  Routine:  Profile
+ *
+ *  Description: This is the call entry point for starting, stopping
+ *               and reading the clock-tick CPU profile.
+ *
+ *  Arguments:    int             command -- PROFILE_START, PROFILE_STOP
+ *                                           or PROFILE_DUMP
+ *                profile_sample *samples -- where PROFILE_DUMP copies the
+ *                                           per-process samples
+ *                int             max     -- size of samples
+ *                int            *count   -- pointer to output value
+ *                int            *ticks   -- pointer to output value
+ *                (output values, for PROFILE_DUMP: processes copied, and
+ *                 ticks sampled in all; either pointer may be 0)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int Profile(int command, profile_sample *samples, int max,
+            int *count, int *ticks)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_PROFILE;
+    sysArg.arg1 = (void *) ( (long) command);
+    sysArg.arg2 = (void *) samples;
+    sysArg.arg3 = (void *) ( (long) max);
+
+    USLOSS_Syscall(&sysArg);
+
+    if (count)
+        *count = (long) sysArg.arg1;
+    if (ticks)
+        *ticks = (long) sysArg.arg2;
+    return (long) sysArg.arg4;
+} /* end of Profile */
+
+
+/*
+ *  Routine:  TermCompletionQueue
+ *
+ *  Description: This is the call entry point for creating a queue that
+ *               asynchronous terminal requests report completion on.
+ *
+ *  Arguments:    int *cq -- pointer to output value
+ *                (output value: the new queue)
+ *
+ *  Return Value: 0 means success, -1 means no queue is left
+ */
+int TermCompletionQueue(int *cq)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_TERMCQCREATE;
+
+    USLOSS_Syscall(&sysArg);
+
+    *cq = (long) sysArg.arg1;
+    return (long) sysArg.arg4;
+} /* end of TermCompletionQueue */
+
+
+/*
+ *  Routine:  TermCompletionQueueRelease
+ *
+ *  Description: This is the call entry point for freeing a completion
+ *               queue made by TermCompletionQueue. Requests still
+ *               waiting on it are dropped without completing.
+ *
+ *  Arguments:    int cq -- the queue
+ *
+ *  Return Value: 0 means success, -1 means cq is not a queue the caller
+ *                made
+ */
+int TermCompletionQueueRelease(int cq)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_TERMCQRELEASE;
+    sysArg.arg1 = (void *) ( (long) cq);
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of TermCompletionQueueRelease */
+
+
+/*
+ *  Routine:  TermReadAsync
+ *
+ *  Description: This is the call entry point for reading a line from a
+ *               terminal without waiting for it. The buffer must stay
+ *               valid until the completion arrives.
+ *
+ *  Arguments:    char *buffer     -- where the line is stored
+ *                int   bufferSize -- size of buffer
+ *                int   unitID     -- which terminal
+ *                int   cq         -- completion queue to report to
+ *                int   tag        -- copied into the completion
+ *
+ *  Return Value: 0 means success, 1 means too many requests are
+ *                outstanding, -1 means error occurs
+ */
+int TermReadAsync(char *buffer, int bufferSize, int unitID, int cq, int tag)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_TERMREADASYNC;
+    sysArg.arg1 = (void *) buffer;
+    sysArg.arg2 = (void *) ( (long) bufferSize);
+    sysArg.arg3 = (void *) ( (long) unitID);
+    sysArg.arg4 = (void *) ( (long) cq);
+    sysArg.arg5 = (void *) ( (long) tag);
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of TermReadAsync */
+
+
+/*
+ *  Routine:  TermWriteAsync
+ *
+ *  Description: This is the call entry point for writing a line to a
+ *               terminal without waiting for it. The line is copied, so
+ *               the buffer can be reused at once.
+ *
+ *  Arguments:    char *buffer     -- line to write
+ *                int   bufferSize -- number of characters in buffer,
+ *                                    at least 1
+ *                int   unitID     -- which terminal
+ *                int   cq         -- completion queue to report to
+ *                int   tag        -- copied into the completion
+ *
+ *  Return Value: 0 means success, 1 means too many requests are
+ *                outstanding, -1 means error occurs
+ */
+int TermWriteAsync(char *buffer, int bufferSize, int unitID, int cq, int tag)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_TERMWRITEASYNC;
+    sysArg.arg1 = (void *) buffer;
+    sysArg.arg2 = (void *) ( (long) bufferSize);
+    sysArg.arg3 = (void *) ( (long) unitID);
+    sysArg.arg4 = (void *) ( (long) cq);
+    sysArg.arg5 = (void *) ( (long) tag);
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of TermWriteAsync */
+
+
+/*
+ *  Routine:  TermComplete
+ *
+ *  Description: This is the call entry point for taking the next
+ *               completion off a terminal completion queue.
+ *
+ *  Arguments:    int              cq   -- completion queue
+ *                term_completion *done -- where to copy the completion
+ *                int              wait -- nonzero to block until there
+ *                                         is one
+ *
+ *  Return Value: 0 means success, 1 means wait was 0 and nothing has
+ *                completed, -1 means error occurs
+ */
+int TermComplete(int cq, term_completion *done, int wait)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_TERMCOMPLETE;
+    sysArg.arg1 = (void *) ( (long) cq);
+    sysArg.arg2 = (void *) done;
+    sysArg.arg3 = (void *) ( (long) wait);
+
+    USLOSS_Syscall(&sysArg);
+
+    return (long) sysArg.arg4;
+} /* end of TermComplete */
+
+
+/*
+ *  Routine:  Batch
+ *
+ *  Description: This is the call entry point for running several phase 4
+ *               system calls in one trap. Each entry of calls holds a
+ *               call's number and arguments, set the way its own wrapper
+ *               sets them, and receives its outputs the same way. The
+ *               calls run in order; disk transfers next to each other on
+ *               different physical units run at the same time.
+ *
+ *  Arguments:    USLOSS_Sysargs *calls -- the calls
+ *                int             count -- number of calls, at most BATCH_MAX
+ *                int            *ran   -- number of calls run
+ *                (output value: completion status)
+ *
+ *  Return Value: 0 means success, -1 means an entry was not a phase 4
+ *                call or the arguments were invalid; *ran tells which
+ */
+int Batch(USLOSS_Sysargs *calls, int count, int *ran)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_BATCH;
+    sysArg.arg1 = (void *) calls;
+    sysArg.arg2 = (void *) ( (long) count);
+
+    USLOSS_Syscall(&sysArg);
+
+    *ran = (long) sysArg.arg1;
+    return (long) sysArg.arg4;
+} /* end of Batch */
+
+
+/*
+ *  Routine:  IoSetup
+ *
+ *  Description: This is the call entry point for registering a submission
+ *               and completion ring with the kernel. The kernel resets its
+ *               counters; the ring must stay valid until the process quits.
+ *
+ *  Arguments:    io_ring *ring -- the ring
+ *                int     *id   -- pointer to output value
+ *                (output value: the ring's id for IoEnter)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int IoSetup(io_ring *ring, int *id)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_IO_SETUP;
+    sysArg.arg1 = (void *) ring;
+
+    USLOSS_Syscall(&sysArg);
+
+    *id = (long) sysArg.arg1;
+    return (long) sysArg.arg4;
+} /* end of IoSetup */
+
+
+/*
+ *  Routine:  IoEnter
+ *
+ *  Description: This is the call entry point for submitting the entries
+ *               added to a ring's submission queue and, optionally,
+ *               waiting for completions.
+ *
+ *  Arguments:    int  id          -- ring, as returned by IoSetup
+ *                int  toSubmit    -- most entries to take from the ring
+ *                int  minComplete -- completions to wait for; returns
+ *                                    early once nothing is in flight
+ *                int *submitted   -- pointer to output value
+ *                (output value: number of entries taken)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int IoEnter(int id, int toSubmit, int minComplete, int *submitted)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_IO_ENTER;
+    sysArg.arg1 = (void *) ( (long) id);
+    sysArg.arg2 = (void *) ( (long) toSubmit);
+    sysArg.arg3 = (void *) ( (long) minComplete);
+
+    USLOSS_Syscall(&sysArg);
+
+    *submitted = (long) sysArg.arg1;
+    return (long) sysArg.arg4;
+} /* end of IoEnter */
+
+
+/*
+ *  Routine:  DiskCopy
+ *
+ *  Description: This is the call entry point for copying sectors from one
+ *               disk region to another without passing them through user
+ *               memory. Overlapping regions are handled.
+ *
+ *  Arguments:    int  srcUnit  -- which disk to copy from
+ *                int  srcTrack -- first track to copy from
+ *                int  srcFirst -- first sector to copy from
+ *                int  dstUnit  -- which disk to copy to
+ *                int  dstTrack -- first track to copy to
+ *                int  dstFirst -- first sector to copy to
+ *                int  sectors  -- number of sectors to copy
+ *                int *status   -- pointer to output value
+ *                (output value: completion status)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskCopy(int srcUnit, int srcTrack, int srcFirst, int dstUnit,
+             int dstTrack, int dstFirst, int sectors, int *status)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    /* Both positions go as sector numbers, to fit the five arguments */
+    if (srcTrack < 0 || srcFirst < 0 || srcFirst >= USLOSS_DISK_TRACK_SIZE ||
+        dstTrack < 0 || dstFirst < 0 || dstFirst >= USLOSS_DISK_TRACK_SIZE)
+        return -1;
+    sysArg.number = SYS_DISKCOPY;
+    sysArg.arg1 = (void *) ( (long) srcUnit);
+    sysArg.arg2 = (void *) ( (long) srcTrack*USLOSS_DISK_TRACK_SIZE + srcFirst);
+    sysArg.arg3 = (void *) ( (long) dstUnit);
+    sysArg.arg4 = (void *) ( (long) dstTrack*USLOSS_DISK_TRACK_SIZE + dstFirst);
+    sysArg.arg5 = (void *) ( (long) sectors);
+
+    USLOSS_Syscall(&sysArg);
+
+    *status = (long) sysArg.arg1;
+    return (long) sysArg.arg4;
+} /* end of DiskCopy */
+
+
+/*
+ *  Routine:  DiskFill
+ *
+ *  Description: This is the call entry point for writing one byte value
+ *               to every byte of a range of sectors, without a buffer.
+ *
+ *  Arguments:    int  unit    -- which disk to write
+ *                int  track   -- first track to write
+ *                int  first   -- first sector to write
+ *                int  sectors -- number of sectors to write
+ *                int  pattern -- byte value to write, 0 to 255
+ *                int *status  -- pointer to output value
+ *                (output value: completion status)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskFill(int unit, int track, int first, int sectors, int pattern,
+             int *status)
+{
+    USLOSS_Sysargs sysArg;
+
+    CHECKMODE;
+    sysArg.number = SYS_DISKFILL;
+    sysArg.arg1 = (void *) ( (long) pattern);
+    sysArg.arg2 = (void *) ( (long) sectors);
+    sysArg.arg3 = (void *) ( (long) track);
+    sysArg.arg4 = (void *) ( (long) first);
+    sysArg.arg5 = (void *) ( (long) unit);
+
+    USLOSS_Syscall(&sysArg);
+
+    *status = (long) sysArg.arg1;
+    return (long) sysArg.arg4;
+} /* end of DiskFill */
+
+
+/*
+ *  Routine:  DiskZero
+ *
+ *  Description: This is the call entry point for zeroing a range of
+ *               sectors. Same as DiskFill with a pattern of 0.
+ *
+ *  Arguments:    int  unit    -- which disk to write
+ *                int  track   -- first track to write
+ *                int  first   -- first sector to write
+ *                int  sectors -- number of sectors to write
+ *                int *status  -- pointer to output value
+ *                (output value: completion status)
+ *
+ *  Return Value: 0 means success, -1 means error occurs
+ */
+int DiskZero(int unit, int track, int first, int sectors, int *status)
+{
+    return DiskFill(unit, track, first, sectors, 0, status);
+} /* end of DiskZero */
+
 /* end libuser.c */
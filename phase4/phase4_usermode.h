@@ -5,6 +5,8 @@
 #ifndef _PHASE4_USERMODE_H
 #define _PHASE4_USERMODE_H
 
+#include "phase4.h"
+
 /*
  * Function prototypes for this phase.
  */
@@ -20,5 +22,33 @@ extern  int  TermRead (char *buffer, int bufferSize, int unitID,
                        int *numCharsRead);
 extern  int  TermWrite(char *buffer, int bufferSize, int unitID,
                        int *numCharsRead);
+extern  const sys_info *SysInfo(void);
+extern  int  DiskStats(int unit, disk_stats *stats);
+extern  int  DiskSetLimit(int pid, int sectorsPerSec, int opsPerSec);
+extern  int  DiskGetLimit(int pid, disk_qos *qos);
+extern  int  DiskResync(int unit, int *stale0, int *stale1);
+extern  int  DiskTrace(int unit, disk_trace_record *records, int max,
+                       int *count, int *lost);
+extern  int  KTrace(int subsystem, ktrace_record *records, int max,
+                    int *count, int *lost);
+extern  int  ProcIO(int pid, proc_io *io);
+extern  int  Profile(int command, profile_sample *samples, int max,
+                     int *count, int *ticks);
+extern  int  TermCompletionQueue(int *cq);
+extern  int  TermCompletionQueueRelease(int cq);
+extern  int  TermReadAsync(char *buffer, int bufferSize, int unitID,
+                           int cq, int tag);
+extern  int  TermWriteAsync(char *buffer, int bufferSize, int unitID,
+                            int cq, int tag);
+extern  int  TermComplete(int cq, term_completion *done, int wait);
+extern  int  Batch(USLOSS_Sysargs *calls, int count, int *ran);
+extern  int  IoSetup(io_ring *ring, int *id);
+extern  int  IoEnter(int id, int toSubmit, int minComplete, int *submitted);
+extern  int  DiskCopy(int srcUnit, int srcTrack, int srcFirst, int dstUnit,
+                      int dstTrack, int dstFirst, int sectors, int *status);
+extern  int  DiskFill (int unit, int track, int first, int sectors,
+                       int pattern, int *status);
+extern  int  DiskZero (int unit, int track, int first, int sectors,
+                       int *status);
 
 #endif /* _PHASE4_H */
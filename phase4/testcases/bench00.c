@@ -0,0 +1,62 @@
+/* Benchmark: sequential reads and writes of each whole disk. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+static char image[BENCH_MAX_SECTORS*512];
+
+
+
+int start4(char *arg)
+{
+    int unit, tracks, sector, t, status;
+    char name[64];
+
+    USLOSS_Console("start4(): sequential disk benchmark\n");
+
+    for (unit = 0; unit < 2; unit++) {
+        tracks = bench_load_disk(unit, image);
+
+        sprintf(name, "seq_read_disk%d_1sector", unit);
+        bench_begin(name);
+        for (sector = 0; sector < tracks*16; sector++) {
+            t = bench_time();
+            DiskRead(image + sector*512, unit, sector/16, sector%16, 1, &status);
+            bench_record(t, 1);
+        }
+        bench_end();
+
+        sprintf(name, "seq_read_disk%d_8sector", unit);
+        bench_begin(name);
+        for (sector = 0; sector < tracks*16; sector += 8) {
+            t = bench_time();
+            DiskRead(image + sector*512, unit, sector/16, sector%16, 8, &status);
+            bench_record(t, 8);
+        }
+        bench_end();
+
+        sprintf(name, "seq_write_disk%d_8sector", unit);
+        bench_begin(name);
+        for (sector = 0; sector < tracks*16; sector += 8) {
+            t = bench_time();
+            DiskWrite(image + sector*512, unit, sector/16, sector%16, 8, &status);
+            bench_record(t, 8);
+        }
+        bench_end();
+    }
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* Benchmark: random single-sector reads and writes on each disk. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+#define OPS 200
+
+static char image[BENCH_MAX_SECTORS*512];
+
+
+
+int start4(char *arg)
+{
+    int unit, tracks, i, sector, t, status;
+    char name[64];
+
+    USLOSS_Console("start4(): random disk benchmark\n");
+
+    for (unit = 0; unit < 2; unit++) {
+        tracks = bench_load_disk(unit, image);
+
+        sprintf(name, "rand_read_disk%d", unit);
+        bench_begin(name);
+        for (i = 0; i < OPS; i++) {
+            sector = bench_random() % (tracks*16);
+            t = bench_time();
+            DiskRead(image + sector*512, unit, sector/16, sector%16, 1, &status);
+            bench_record(t, 1);
+        }
+        bench_end();
+
+        sprintf(name, "rand_write_disk%d", unit);
+        bench_begin(name);
+        for (i = 0; i < OPS; i++) {
+            sector = bench_random() % (tracks*16);
+            t = bench_time();
+            DiskWrite(image + sector*512, unit, sector/16, sector%16, 1, &status);
+            bench_record(t, 1);
+        }
+        bench_end();
+    }
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
@@ -0,0 +1,68 @@
+/* Benchmark: several processes doing mixed random I/O on both disks at once. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+#define PROCS   8
+#define OPS     50
+
+static char image[2][BENCH_MAX_SECTORS*512];
+static int  tracks[2];
+
+
+
+int worker(char *arg)
+{
+    int id = arg[0] - '0';
+    int unit = id % 2;
+    int i, sector, count, t, status;
+    char buf[4*512];
+
+    for (i = 0; i < OPS; i++) {
+        count = 1 + bench_random() % 4;
+        sector = bench_random() % (tracks[unit]*16 - count);
+        t = bench_time();
+        if (bench_random() % 4 == 0)
+            DiskWrite(image[unit] + sector*512, unit, sector/16, sector%16, count, &status);
+        else
+            DiskRead(buf, unit, sector/16, sector%16, count, &status);
+        bench_record(t, count);
+    }
+    return 0;
+}
+
+int start4(char *arg)
+{
+    int i, pid, status;
+    char args[PROCS][2];
+
+    USLOSS_Console("start4(): contention benchmark, %d processes\n", PROCS);
+
+    tracks[0] = bench_load_disk(0, image[0]);
+    tracks[1] = bench_load_disk(1, image[1]);
+
+    bench_begin("mixed_8proc_both_disks");
+    for (i = 0; i < PROCS; i++) {
+        args[i][0] = '0' + i;
+        args[i][1] = '\0';
+        Spawn("worker", worker, args[i], USLOSS_MIN_STACK, 3, &pid);
+    }
+    for (i = 0; i < PROCS; i++)
+        Wait(&pid, &status);
+    bench_end();
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
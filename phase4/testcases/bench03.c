@@ -0,0 +1,59 @@
+/* Benchmark: transfers spanning several tracks. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+#define OPS 10
+
+static char image[BENCH_MAX_SECTORS*512];
+
+
+
+int start4(char *arg)
+{
+    int tracks, size, i, sector, t, status;
+    int sizes[] = { 32, 64 };
+    char name[64];
+
+    USLOSS_Console("start4(): multi-track transfer benchmark\n");
+
+    tracks = bench_load_disk(1, image);
+
+    for (size = 0; size < 2; size++) {
+        sprintf(name, "multitrack_read_disk1_%dsector", sizes[size]);
+        bench_begin(name);
+        for (i = 0; i < OPS; i++) {
+            /* start mid-track so every transfer crosses track boundaries */
+            sector = (bench_random() % (tracks - sizes[size]/16 - 1))*16 + 8;
+            t = bench_time();
+            DiskRead(image + sector*512, 1, sector/16, sector%16, sizes[size], &status);
+            bench_record(t, sizes[size]);
+        }
+        bench_end();
+
+        sprintf(name, "multitrack_write_disk1_%dsector", sizes[size]);
+        bench_begin(name);
+        for (i = 0; i < OPS; i++) {
+            sector = (bench_random() % (tracks - sizes[size]/16 - 1))*16 + 8;
+            t = bench_time();
+            DiskWrite(image + sector*512, 1, sector/16, sector%16, sizes[size], &status);
+            bench_record(t, sizes[size]);
+        }
+        bench_end();
+    }
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
@@ -0,0 +1,45 @@
+/* Benchmark: DiskSize right after boot, while the track counts are being probed, and afterwards. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+#define OPS 100
+
+
+
+int start4(char *arg)
+{
+    int unit, i, t, sectorSize, trackSize, diskSize;
+
+    /* first thing, before anything else touches the disks */
+    bench_begin("disksize_boot");
+    for (unit = 0; unit < 2; unit++) {
+        t = bench_time();
+        DiskSize(unit, &sectorSize, &trackSize, &diskSize);
+        bench_record(t, 0);
+    }
+    bench_end();
+
+    bench_begin("disksize_warm");
+    for (i = 0; i < OPS; i++) {
+        t = bench_time();
+        DiskSize(i % 2, &sectorSize, &trackSize, &diskSize);
+        bench_record(t, 0);
+    }
+    bench_end();
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+/* Benchmark: fixed cost of each phase 4 system call, through the trap path,
+ * and of the same calls made BATCH_CALLS at a time with Batch().
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+#define WARMUP 20
+#define CALLS  200
+#define BATCH_CALLS 8
+
+static char buf[512];
+
+static int  sectorSize, trackSize, diskSize;
+static int  next_sector;
+static disk_stats stats;
+static disk_qos qos;
+static disk_trace_record record;
+static int  mypid;
+static USLOSS_Sysargs batch[BATCH_CALLS];
+
+static void call_sleep(void)     { Sleep(0); }
+static void call_disksize(void)  { DiskSize(0, &sectorSize, &trackSize, &diskSize); }
+static void call_termwrite(void) { int n; TermWrite("x", 1, 3, &n); }
+static void call_diskstats(void) { DiskStats(0, &stats); }
+static void call_getlimit(void)  { DiskGetLimit(mypid, &qos); }
+static void call_resync(void)    { int s0, s1; DiskResync(-1, &s0, &s1); }
+static void call_disktrace(void) { int count, lost; DiskTrace(0, &record, 1, &count, &lost); }
+
+/* BATCH_CALLS DiskStats calls in one trap; each record is the whole batch */
+static void call_batch_diskstats(void)
+{
+    int i, ran;
+    for (i = 0; i < BATCH_CALLS; i++) {
+        batch[i].number = SYS_DISKSTATS;
+        batch[i].arg1 = (void *) 0L;
+        batch[i].arg2 = (void *) &stats;
+    }
+    Batch(batch, BATCH_CALLS, &ran);
+}
+
+/* Reads sector after sector, so once the read-ahead window has opened
+ * nearly every call is served from the kernel's cache.
+ */
+static void call_cached_read(void)
+{
+    int status;
+    DiskRead(buf, 1, next_sector/16, next_sector%16, 1, &status);
+    next_sector = (next_sector + 1) % (diskSize*16);
+}
+
+static void measure(char *name, void (*call)(void), int calls)
+{
+    int i, t;
+    for (i = 0; i < WARMUP; i++)
+        call();
+    bench_begin(name);
+    for (i = 0; i < calls; i++) {
+        t = bench_time();
+        call();
+        bench_record(t, 0);
+    }
+    bench_end();
+}
+
+int start4(char *arg)
+{
+    USLOSS_Console("start4(): syscall overhead benchmark\n");
+
+    GetPID(&mypid);
+    DiskSize(1, &sectorSize, &trackSize, &diskSize);
+
+    measure("syscall_disksize", call_disksize, CALLS);
+    measure("syscall_diskstats", call_diskstats, CALLS);
+    measure("syscall_batch8_diskstats", call_batch_diskstats, CALLS/BATCH_CALLS);
+    measure("syscall_diskgetlimit", call_getlimit, CALLS);
+    measure("syscall_diskresync_query", call_resync, CALLS);
+    measure("syscall_disktrace_1", call_disktrace, CALLS);
+    measure("syscall_diskread_cached", call_cached_read, CALLS);
+    measure("syscall_termwrite_1char", call_termwrite, CALLS);
+    /* waits for the next clock tick, so fewer calls */
+    measure("syscall_sleep0", call_sleep, 20);
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
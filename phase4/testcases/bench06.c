@@ -0,0 +1,119 @@
+/* Benchmark: how late Sleep() wakes its callers, and what each clock tick costs. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+/* leave room in the process table for the kernel's own processes */
+#define MAX_SLEEPERS (MAXPROC - 20)
+#define MAX_GAPS     1024
+
+static int  seconds[MAX_SLEEPERS];
+static int  lateness[MAX_SLEEPERS];
+static int  remaining;
+
+static int  gaps[MAX_GAPS];
+static int  gap_count;
+static int  loop_cost;
+
+
+
+int sleeper(char *arg)
+{
+    int id = atoi(arg);
+    int t = bench_time();
+
+    Sleep(seconds[id]);
+    lateness[id] = bench_time() - t - seconds[id]*1000000;
+    remaining--;
+    return 0;
+}
+
+/* Runs below every sleeper and polls the clock. Any gap well above the cost
+ * of one loop is time taken away by a clock tick: sleep_daemon and whatever
+ * it woke up.
+ */
+int spinner(char *arg)
+{
+    int last = bench_time();
+    int now;
+
+    while (remaining > 0) {
+        now = bench_time();
+        if (now - last > 2*loop_cost && gap_count < MAX_GAPS)
+            gaps[gap_count++] = now - last - loop_cost;
+        last = now;
+    }
+    return 0;
+}
+
+static void calibrate(void)
+{
+    int i, last, now;
+
+    loop_cost = 1000000;
+    last = bench_time();
+    for (i = 0; i < 100; i++) {
+        now = bench_time();
+        if (now - last < loop_cost)
+            loop_cost = now - last;
+        last = now;
+    }
+}
+
+static void run(char *scenario, int sleepers, int identical)
+{
+    char name[64], args[MAX_SLEEPERS][8];
+    int i, pid, status;
+
+    for (i = 0; i < sleepers; i++)
+        seconds[i] = identical ? 1 : 1 + bench_random() % 3;
+    remaining = sleepers;
+    gap_count = 0;
+
+    sprintf(name, "sleep_lateness_%s_%d", scenario, sleepers);
+    bench_begin(name);
+    Spawn("spinner", spinner, NULL, USLOSS_MIN_STACK, 5, &pid);
+    for (i = 0; i < sleepers; i++) {
+        sprintf(args[i], "%d", i);
+        Spawn("sleeper", sleeper, args[i], USLOSS_MIN_STACK, 2, &pid);
+    }
+    for (i = 0; i <= sleepers; i++)
+        Wait(&pid, &status);
+    for (i = 0; i < sleepers; i++)
+        bench_sample(lateness[i], 0);
+    bench_end();
+
+    sprintf(name, "sleep_tick_cost_%s_%d", scenario, sleepers);
+    bench_begin(name);
+    for (i = 0; i < gap_count; i++)
+        bench_sample(gaps[i], 0);
+    bench_end();
+}
+
+int start4(char *arg)
+{
+    USLOSS_Console("start4(): sleep accuracy benchmark, up to %d sleepers\n", MAX_SLEEPERS);
+
+    calibrate();
+
+    run("random", 8, 0);
+    run("random", MAX_SLEEPERS, 0);
+    run("identical", 8, 1);
+    run("identical", MAX_SLEEPERS, 1);
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
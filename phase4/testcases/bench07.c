@@ -0,0 +1,140 @@
+/* Benchmark: line throughput and latency on all four terminals at once.
+ *
+ * Needs term0.in-term3.in from tools/termgen; 'make bench' generates them.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+#define TERMINALS   4
+#define MAX_LINES   2048
+#define WRITE_LINES 100
+#define WRITE_LEN   72
+
+typedef struct term_result {
+    int start, end;
+    int lines, chars;
+    int expected;     /* input: line count from the end line */
+    int bad;          /* input: lines for another terminal or out of order */
+    int latency[MAX_LINES];
+} term_result;
+
+static term_result input[TERMINALS];
+static term_result output[TERMINALS];
+
+
+
+/* Time spent blocked in TermRead() is the wait for each line */
+int reader(char *arg)
+{
+    int term = atoi(arg);
+    term_result *r = &input[term];
+    char buf[MAXLINE+1];
+    int t, len, status, who, seq, last = -1;
+
+    r->start = bench_time();
+    while (1) {
+        memset(buf, 0, sizeof(buf));
+        t = bench_time();
+        TermRead(buf, MAXLINE, term, &len);
+        if (r->lines < MAX_LINES)
+            r->latency[r->lines] = bench_time() - t;
+
+        if (sscanf(buf, "T%d end %d", &who, &status) == 2 && who == term) {
+            r->expected = status;
+            break;
+        }
+        r->lines++;
+        r->chars += len;
+        if (sscanf(buf, "T%d %d", &who, &seq) != 2 || who != term || seq <= last)
+            r->bad++;
+        else
+            last = seq;
+    }
+    r->end = bench_time();
+    return 0;
+}
+
+/* Time spent in TermWrite() is how long each line waited to be queued */
+int writer(char *arg)
+{
+    int term = atoi(arg);
+    term_result *r = &output[term];
+    char line[WRITE_LEN+1];
+    int i, t, len;
+
+    r->start = bench_time();
+    for (i = 0; i < WRITE_LINES; i++) {
+        sprintf(line, "T%d out %05d ", term, i);
+        memset(line + strlen(line), 'x', WRITE_LEN-1 - strlen(line));
+        line[WRITE_LEN-1] = '\n';
+        line[WRITE_LEN] = '\0';
+        t = bench_time();
+        TermWrite(line, WRITE_LEN, term, &len);
+        r->latency[i] = bench_time() - t;
+        r->lines++;
+        r->chars += len;
+    }
+    r->end = bench_time();
+    return 0;
+}
+
+static void report(char *direction, int term, term_result *r)
+{
+    char name[64];
+    int i, elapsed = r->end - r->start;
+
+    if (elapsed <= 0)
+        elapsed = 1;
+    sprintf(name, "term%d_%s", term, direction);
+    bench_begin(name);
+    for (i = 0; i < r->lines && i < MAX_LINES; i++)
+        bench_sample(r->latency[i], 0);
+    bench_span(r->start, r->end);
+    bench_end();
+
+    USLOSS_Console("BENCH name=%s_chars chars=%d chars_per_sec=%ld dropped=%d bad=%d\n",
+                   name, r->chars, r->chars * 1000000L / elapsed,
+                   r->expected > r->lines ? r->expected - r->lines : 0, r->bad);
+}
+
+int start4(char *arg)
+{
+    char args[TERMINALS][2];
+    int i, pid, status;
+
+    USLOSS_Console("start4(): terminal benchmark, %d terminals\n", TERMINALS);
+
+    memset(input, 0, sizeof(input));
+    memset(output, 0, sizeof(output));
+
+    for (i = 0; i < TERMINALS; i++) {
+        args[i][0] = '0' + i;
+        args[i][1] = '\0';
+        Spawn("reader", reader, args[i], USLOSS_MIN_STACK, 2, &pid);
+        Spawn("writer", writer, args[i], USLOSS_MIN_STACK, 3, &pid);
+    }
+    for (i = 0; i < 2*TERMINALS; i++)
+        Wait(&pid, &status);
+
+    for (i = 0; i < TERMINALS; i++) {
+        report("in", i, &input[i]);
+        report("out", i, &output[i]);
+    }
+
+    USLOSS_Console("start4(): done\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+#include "bench_common.h"
+
+static char bench_name[64];
+static int  bench_start;
+static int  bench_stop;
+static int  bench_ops;
+static int  bench_sectors;
+static int  bench_samples[BENCH_MAX_SAMPLES];
+static int  bench_seed = 452;
+
+
+
+void bench_begin(char *name)
+{
+    strncpy(bench_name, name, sizeof(bench_name)-1);
+    bench_ops = 0;
+    bench_sectors = 0;
+    bench_start = bench_time();
+    bench_stop = 0;
+}
+
+void bench_span(int startTime, int endTime)
+{
+    bench_start = startTime;
+    bench_stop = endTime;
+}
+
+int bench_time(void)
+{
+    int now;
+    GetTimeofDay(&now);
+    return now;
+}
+
+void bench_record(int startTime, int sectors)
+{
+    bench_sample(bench_time() - startTime, sectors);
+}
+
+void bench_sample(int us, int sectors)
+{
+    if (bench_ops < BENCH_MAX_SAMPLES)
+        bench_samples[bench_ops] = us;
+    bench_ops++;
+    bench_sectors += sectors;
+}
+
+static int percentile(int count, int pct)
+{
+    int i = count * pct / 100;
+    if (i >= count)
+        i = count - 1;
+    return bench_samples[i];
+}
+
+void bench_end(void)
+{
+    int elapsed = (bench_stop ? bench_stop : bench_time()) - bench_start;
+    int count = bench_ops < BENCH_MAX_SAMPLES ? bench_ops : BENCH_MAX_SAMPLES;
+    int i, j;
+
+    /* insertion sort; sample counts are small */
+    for (i = 1; i < count; i++) {
+        int v = bench_samples[i];
+        for (j = i; j > 0 && bench_samples[j-1] > v; j--)
+            bench_samples[j] = bench_samples[j-1];
+        bench_samples[j] = v;
+    }
+
+    if (elapsed <= 0)
+        elapsed = 1;
+    USLOSS_Console("BENCH name=%s ops=%d sectors=%d elapsed_us=%d ops_per_sec=%ld sectors_per_sec=%ld "
+                   "min_us=%d p50_us=%d p90_us=%d p99_us=%d max_us=%d\n",
+                   bench_name, bench_ops, bench_sectors, elapsed,
+                   bench_ops * 1000000L / elapsed, bench_sectors * 1000000L / elapsed,
+                   count ? bench_samples[0] : 0, count ? percentile(count, 50) : 0, count ? percentile(count, 90) : 0,
+                   count ? percentile(count, 99) : 0, count ? bench_samples[count-1] : 0);
+}
+
+/* deterministic, so every run does the same work */
+int bench_random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 8) & 0x7fffff;
+}
+
+/* Reads a whole disk into image, so write benchmarks can put back exactly
+ * what was there and leave the disk files unchanged.  Returns the number of
+ * tracks, at most BENCH_MAX_SECTORS/16.
+ */
+int bench_load_disk(int unit, char *image)
+{
+    int sectorSize, trackSize, tracks, track, status;
+
+    DiskSize(unit, &sectorSize, &trackSize, &tracks);
+    if (tracks > BENCH_MAX_SECTORS/16)
+        tracks = BENCH_MAX_SECTORS/16;
+    for (track = 0; track < tracks; track++)
+        DiskRead(image + track*16*512, unit, track, 0, 16, &status);
+    return tracks;
+}
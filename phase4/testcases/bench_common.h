@@ -0,0 +1,36 @@
+/*
+ * Shared measurement code for the benchmark testcases (benchNN.c).
+ *
+ * Each benchmark brackets a run with bench_begin()/bench_end() and calls
+ * bench_record() once per operation, or bench_sample() with a time it
+ * measured itself. Samples gathered by other processes can be replayed
+ * afterwards, with bench_span() giving the interval they covered.
+ * bench_end() prints one line:
+ *
+ *   BENCH name=<name> ops=<n> sectors=<n> elapsed_us=<n> ops_per_sec=<n>
+ *         sectors_per_sec=<n> min_us=<n> p50_us=<n> p90_us=<n> p99_us=<n> max_us=<n>
+ *
+ * (all on one line), which 'make bench' collects into bench_results.txt.
+ * Times come from GetTimeofDay(), i.e. currentTime() in the kernel, since
+ * testcases run in user mode.
+ */
+
+#ifndef _BENCH_COMMON_H
+#define _BENCH_COMMON_H
+
+#define BENCH_MAX_SAMPLES 4096
+
+/* Largest disk the benchmarks keep a copy of, in sectors */
+#define BENCH_MAX_SECTORS (64*16)
+
+extern void bench_begin(char *name);
+extern int  bench_time(void);
+extern void bench_record(int startTime, int sectors);
+extern void bench_sample(int us, int sectors);
+extern void bench_span(int startTime, int endTime);
+extern void bench_end(void);
+
+extern int  bench_random(void);
+extern int  bench_load_disk(int unit, char *image);
+
+#endif /* _BENCH_COMMON_H */
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+/*
+ * A priority 1 child spawned by a priority 3 parent runs, and reads the
+ * disk, before Spawn returns to its parent. Its read must be ordered by
+ * its own priority from the start: it has to go ahead of the priority 2
+ * reads already queued, even when the disk picks its next request before
+ * the parent gets to run again.
+ */
+
+int release;
+disk_trace_record records[DISK_TRACE_RECORDS];
+
+int Reader(char *arg)
+{
+    char buf[512];
+    int track, status;
+
+    sscanf(arg, "%d", &track);
+    if (track == 13)
+        SemV(release);
+    DiskRead(buf, 1, track, 0, 1, &status);
+    return 0;
+}
+
+/* Keeps the parent from running again until the disk has moved on */
+int Spinner(char *arg)
+{
+    int start, now;
+
+    SemP(release);
+    GetTimeofDay(&start);
+    do
+        GetTimeofDay(&now);
+    while (now - start < 500000);
+    return 0;
+}
+
+int start4(char *arg)
+{
+    int pid, status, count, lost;
+    char *names[4] = { "Reader2a", "Reader2b", "Reader2c", "Reader1" };
+    char *tracks[4] = { "5", "11", "12", "13" };
+    int pids[4];
+
+    USLOSS_Console("start4(): started\n");
+    SemCreate(0, &release);
+    Spawn("Spinner", Spinner, NULL, USLOSS_MIN_STACK, 2, &pid);
+
+    // Each runs at once, queues its read and blocks; the first one goes
+    // to the disk and the rest wait behind it
+    for (int i = 0; i < 4; i++)
+        Spawn(names[i], Reader, tracks[i], USLOSS_MIN_STACK, i < 3 ? 2 : 1, &pids[i]);
+
+    for (int i = 0; i < 5; i++)
+        Wait(&pid, &status);
+
+    USLOSS_Console("start4(): reads dispatched in this order:\n");
+    DiskTrace(1, records, DISK_TRACE_RECORDS, &count, &lost);
+    for (int r = 0; r < count; r++) {
+        if (records[r].event != DISK_TRACE_DISPATCH)
+            continue;
+        for (int i = 0; i < 4; i++)
+            if (records[r].pid == pids[i])
+                USLOSS_Console("start4():   %s, track %d\n", names[i], records[r].track);
+    }
+
+    USLOSS_Console("start4(): calling Terminate\n");
+    Terminate(0);
+    USLOSS_Console("start4(): should not see this message!\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+/* Mirrored unit: writes 3 sectors through DISK_MIRROR_UNIT, across a track
+ * boundary, and reads them back from the mirror and from each of units 0
+ * and 1, which must both hold a copy.  Also checks DiskSize and bad
+ * arguments on the mirror.
+ */
+
+static char out[3*512];
+static char in[3*512];
+
+static void check(char *what, int unit)
+{
+    int status = -1;
+
+    memset(in, 0, sizeof(in));
+    if (DiskRead(in, unit, 4, 14, 3, &status) < 0 || status != 0)
+        USLOSS_Console("start4(): %s: DiskRead failed, status %d\n", what, status);
+    else
+        USLOSS_Console("start4(): %s: %s\n", what,
+                       memcmp(in, out, sizeof(out)) == 0 ? "same" : "DIFFERENT");
+}
+
+int start4(char *arg)
+{
+    int sectorSize, trackSize, diskSize, size0, size1, result, status = -1;
+    int i;
+
+    USLOSS_Console("start4(): started\n");
+
+    DiskSize(0, &sectorSize, &trackSize, &size0);
+    DiskSize(1, &sectorSize, &trackSize, &size1);
+    result = DiskSize(DISK_MIRROR_UNIT, &sectorSize, &trackSize, &diskSize);
+    USLOSS_Console("start4(): mirror: result %d, sector size %d, track size %d, size is the smaller unit's: %s\n",
+                   result, sectorSize, trackSize,
+                   diskSize == (size0 < size1 ? size0 : size1) ? "yes" : "no");
+
+    for (i = 0; i < sizeof(out); i++)
+        out[i] = 'A' + (i / 512)*7 + i % 13;
+    result = DiskWrite(out, DISK_MIRROR_UNIT, 4, 14, 3, &status);
+    USLOSS_Console("start4(): DiskWrite to the mirror: result %d, status %d\n", result, status);
+
+    check("read through the mirror", DISK_MIRROR_UNIT);
+    check("read from unit 0", 0);
+    check("read from unit 1", 1);
+
+    result = DiskWrite(out, DISK_MIRROR_UNIT, 4, 17, 1, &status);
+    USLOSS_Console("start4(): DiskWrite with first block 17: result %d\n", result);
+    result = DiskWrite(out, DISK_MIRROR_UNIT + 2, 4, 0, 1, &status);
+    USLOSS_Console("start4(): DiskWrite to unit %d: result %d\n", DISK_MIRROR_UNIT + 2, result);
+
+    Terminate(0);
+    return 0;
+}
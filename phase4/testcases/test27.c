@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+/* Striped unit: logical track t of DISK_STRIPE_UNIT is track t/2 of unit
+ * t%2.  Writes 20 sectors from logical track 3, block 8, which covers the
+ * end of logical track 3 and part of logical track 4, then reads each part
+ * back from the physical unit it should be on and from the striped unit.
+ */
+
+static char out[20*512];
+static char in[20*512];
+
+int start4(char *arg)
+{
+    int sectorSize, trackSize, diskSize, size0, size1, result, status = -1;
+    int i;
+
+    USLOSS_Console("start4(): started\n");
+
+    DiskSize(0, &sectorSize, &trackSize, &size0);
+    DiskSize(1, &sectorSize, &trackSize, &size1);
+    result = DiskSize(DISK_STRIPE_UNIT, &sectorSize, &trackSize, &diskSize);
+    USLOSS_Console("start4(): stripe: result %d, sector size %d, track size %d, size is twice the smaller unit's: %s\n",
+                   result, sectorSize, trackSize,
+                   diskSize == 2*(size0 < size1 ? size0 : size1) ? "yes" : "no");
+
+    for (i = 0; i < sizeof(out); i++)
+        out[i] = 'a' + (i / 512) + i % 5;
+    result = DiskWrite(out, DISK_STRIPE_UNIT, 3, 8, 20, &status);
+    USLOSS_Console("start4(): DiskWrite to the stripe: result %d, status %d\n", result, status);
+
+    /* logical track 3, blocks 8-15 */
+    memset(in, 0, sizeof(in));
+    DiskRead(in, 1, 1, 8, 8, &status);
+    USLOSS_Console("start4(): unit 1, track 1, blocks 8-15: status %d, %s\n", status,
+                   memcmp(in, out, 8*512) == 0 ? "same" : "DIFFERENT");
+
+    /* logical track 4, blocks 0-11 */
+    memset(in, 0, sizeof(in));
+    DiskRead(in, 0, 2, 0, 12, &status);
+    USLOSS_Console("start4(): unit 0, track 2, blocks 0-11: status %d, %s\n", status,
+                   memcmp(in, out + 8*512, 12*512) == 0 ? "same" : "DIFFERENT");
+
+    memset(in, 0, sizeof(in));
+    DiskRead(in, DISK_STRIPE_UNIT, 3, 8, 20, &status);
+    USLOSS_Console("start4(): read through the stripe: status %d, %s\n", status,
+                   memcmp(in, out, sizeof(out)) == 0 ? "same" : "DIFFERENT");
+
+    result = DiskRead(in, DISK_STRIPE_UNIT, 3, -1, 1, &status);
+    USLOSS_Console("start4(): DiskRead with first block -1: result %d\n", result);
+
+    Terminate(0);
+    return 0;
+}
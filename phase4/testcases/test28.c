@@ -0,0 +1,76 @@
+/* TERMTEST
+ * Asynchronous terminal I/O. Bad requests to TermWriteAsync,
+ * TermReadAsync and TermCompletionQueueRelease return -1; an empty
+ * TermWriteAsync is one of them, and a blocking TermWrite to the same
+ * terminal still completes after it. Then a read from term 0 and a write
+ * to term 1 are started together and both completions are taken with
+ * TermComplete. Once the queue is released TermComplete returns -1.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+int start4(char *arg)
+{
+    char readBuf[MAXLINE + 1];
+    char line[] = "start4(): written after an empty TermWriteAsync\n";
+    char asyncLine[] = "start4(): written by TermWriteAsync\n";
+    term_completion done[2], c;
+    int cq, result, len, i;
+
+    USLOSS_Console("start4(): started\n");
+
+    result = TermCompletionQueue(&cq);
+    USLOSS_Console("start4(): TermCompletionQueue: result %d\n", result);
+
+    result = TermWriteAsync(asyncLine, strlen(asyncLine), USLOSS_TERM_UNITS, cq, 0);
+    USLOSS_Console("start4(): TermWriteAsync to an invalid terminal: result %d\n", result);
+    result = TermWriteAsync(asyncLine, strlen(asyncLine), 1, -1, 0);
+    USLOSS_Console("start4(): TermWriteAsync to an invalid queue: result %d\n", result);
+    result = TermWriteAsync(NULL, 5, 1, cq, 0);
+    USLOSS_Console("start4(): TermWriteAsync from a NULL buffer: result %d\n", result);
+    result = TermReadAsync(readBuf, 0, 0, cq, 0);
+    USLOSS_Console("start4(): TermReadAsync of 0 characters: result %d\n", result);
+    result = TermCompletionQueueRelease(cq + 1);
+    USLOSS_Console("start4(): releasing a queue that was not made: result %d\n", result);
+
+    result = TermWriteAsync(asyncLine, 0, 1, cq, 0);
+    USLOSS_Console("start4(): TermWriteAsync of 0 characters: result %d\n", result);
+    result = TermWrite(line, strlen(line), 1, &len);
+    USLOSS_Console("start4(): TermWrite after it: result %d, wrote %d of %d\n",
+                   result, len, (int) strlen(line));
+
+    TermReadAsync(readBuf, MAXLINE, 0, cq, 10);
+    TermWriteAsync(asyncLine, strlen(asyncLine), 1, cq, 11);
+    for (i = 0; i < 2; i++) {
+        result = TermComplete(cq, &c, 1);
+        if (result != 0)
+            USLOSS_Console("start4(): TermComplete: result %d\n", result);
+        done[c.tag - 10] = c;
+    }
+    USLOSS_Console("start4(): read completion: operation %d, unit %d, got a line: %s\n",
+                   done[0].operation, done[0].unit,
+                   done[0].count > 0 && readBuf[done[0].count - 1] == '\n' ? "yes" : "no");
+    USLOSS_Console("start4(): write completion: operation %d, unit %d, wrote %d of %d\n",
+                   done[1].operation, done[1].unit, done[1].count, (int) strlen(asyncLine));
+
+    result = TermComplete(cq, &c, 0);
+    USLOSS_Console("start4(): TermComplete on an empty queue: result %d\n", result);
+    result = TermCompletionQueueRelease(cq);
+    USLOSS_Console("start4(): TermCompletionQueueRelease: result %d\n", result);
+    result = TermComplete(cq, &c, 0);
+    USLOSS_Console("start4(): TermComplete after the release: result %d\n", result);
+
+    Terminate(0);
+    return 0;
+}
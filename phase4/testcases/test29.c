@@ -0,0 +1,116 @@
+/* TERMTEST
+ * Submission and completion rings. Disk writes to units 0, 1 and the
+ * mirror, a timeout, a terminal write and some invalid requests are
+ * submitted in one IoEnter; the invalid ones, including an empty terminal
+ * write, complete with -1 and a TermWrite to the same terminal still goes
+ * through afterwards. A second IoEnter reads the sectors back, and they
+ * are compared with what was written. Bad IoSetup and IoEnter calls
+ * return -1.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+static io_ring ring;
+static char out[4*512];
+static char in0[4*512], in1[4*512], inMirror0[512], inMirror1[512];
+static int results[16];
+
+static void add(int opcode, int unit, void *buffer, int length,
+                int track, int first, long user_data)
+{
+    io_sqe *sqe = &ring.sq[ring.sq_tail % IO_RING_ENTRIES];
+
+    sqe->opcode = opcode;
+    sqe->unit = unit;
+    sqe->buffer = buffer;
+    sqe->length = length;
+    sqe->track = track;
+    sqe->first = first;
+    sqe->user_data = user_data;
+    ring.sq_tail++;
+}
+
+static void reap(void)
+{
+    while (ring.cq_head != ring.cq_tail) {
+        io_cqe *cqe = &ring.cq[ring.cq_head % IO_RING_ENTRIES];
+        results[cqe->user_data] = cqe->result;
+        ring.cq_head++;
+    }
+}
+
+int start4(char *arg)
+{
+    char line[] = "start4(): written by TermWrite\n";
+    char ringLine[] = "start4(): written through the ring\n";
+    int id, result, submitted, len, i;
+
+    USLOSS_Console("start4(): started\n");
+
+    for (i = 0; i < sizeof(out); i++)
+        out[i] = 'A' + i % 23;
+
+    result = IoSetup(&ring, &id);
+    USLOSS_Console("start4(): IoSetup: result %d\n", result);
+    result = IoSetup(NULL, &i);
+    USLOSS_Console("start4(): IoSetup with no ring: result %d\n", result);
+    result = IoEnter(id + 1, 0, 0, &submitted);
+    USLOSS_Console("start4(): IoEnter on a ring that was not set up: result %d\n", result);
+    result = IoEnter(id, 0, IO_RING_ENTRIES + 1, &submitted);
+    USLOSS_Console("start4(): IoEnter waiting for too many: result %d\n", result);
+
+    add(IO_OP_DISK_WRITE, 0, out, 4, 5, 14, 1);
+    add(IO_OP_DISK_WRITE, 1, out, 4, 9, 2, 2);
+    add(IO_OP_DISK_WRITE, DISK_MIRROR_UNIT, out, 1, 6, 3, 3);
+    add(IO_OP_TIMEOUT, 0, NULL, 2, 0, 0, 4);
+    add(77, 0, NULL, 0, 0, 0, 5);
+    add(IO_OP_DISK_READ, 0, in0, 1, 5, 17, 6);
+    add(IO_OP_TERM_WRITE, 1, ringLine, 0, 0, 0, 7);
+    result = IoEnter(id, IO_RING_ENTRIES, 7, &submitted);
+    reap();
+    USLOSS_Console("start4(): IoEnter: result %d, submitted %d\n", result, submitted);
+    USLOSS_Console("start4(): write to unit 0: %d\n", results[1]);
+    USLOSS_Console("start4(): write to unit 1: %d\n", results[2]);
+    USLOSS_Console("start4(): write to the mirror: %d\n", results[3]);
+    USLOSS_Console("start4(): timeout: %d\n", results[4]);
+    USLOSS_Console("start4(): invalid opcode: %d\n", results[5]);
+    USLOSS_Console("start4(): read from block 17: %d\n", results[6]);
+    USLOSS_Console("start4(): empty terminal write: %d\n", results[7]);
+
+    result = TermWrite(line, strlen(line), 1, &len);
+    USLOSS_Console("start4(): TermWrite after it: result %d, wrote %d of %d\n",
+                   result, len, (int) strlen(line));
+
+    add(IO_OP_DISK_READ, 0, in0, 4, 5, 14, 8);
+    add(IO_OP_DISK_READ, 1, in1, 4, 9, 2, 9);
+    add(IO_OP_DISK_READ, 0, inMirror0, 1, 6, 3, 10);
+    add(IO_OP_DISK_READ, 1, inMirror1, 1, 6, 3, 11);
+    add(IO_OP_TERM_WRITE, 1, ringLine, strlen(ringLine), 0, 0, 12);
+    result = IoEnter(id, IO_RING_ENTRIES, 5, &submitted);
+    reap();
+    USLOSS_Console("start4(): IoEnter: result %d, submitted %d\n", result, submitted);
+    USLOSS_Console("start4(): unit 0: %d, %s\n", results[8],
+                   memcmp(in0, out, sizeof(out)) == 0 ? "same" : "DIFFERENT");
+    USLOSS_Console("start4(): unit 1: %d, %s\n", results[9],
+                   memcmp(in1, out, sizeof(out)) == 0 ? "same" : "DIFFERENT");
+    USLOSS_Console("start4(): mirror on unit 0: %d, %s\n", results[10],
+                   memcmp(inMirror0, out, 512) == 0 ? "same" : "DIFFERENT");
+    USLOSS_Console("start4(): mirror on unit 1: %d, %s\n", results[11],
+                   memcmp(inMirror1, out, 512) == 0 ? "same" : "DIFFERENT");
+    USLOSS_Console("start4(): terminal write: wrote %d of %d\n", results[12],
+                   (int) strlen(ringLine));
+
+    Terminate(0);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+/* DiskCopy: copies 40 sectors, more than one kernel chunk, from unit 0 to
+ * unit 1, then within unit 1 onto an overlapping region further on and
+ * back onto one further back, and from unit 0 to the mirror. Each copy is
+ * read back and compared with the sectors first written. A copy running
+ * past the end of the disk fails with nothing copied, and bad arguments
+ * return -1.
+ */
+
+#define SECTORS 40
+
+static char out[SECTORS*512];
+static char in[SECTORS*512];
+
+static void check(char *what, int unit, int track, int first, int sectors,
+                  char *expect)
+{
+    int status = -1;
+
+    memset(in, 0, sizeof(in));
+    DiskRead(in, unit, track, first, sectors, &status);
+    USLOSS_Console("start4(): %s: status %d, %s\n", what, status,
+                   memcmp(in, expect, sectors*512) == 0 ? "same" : "DIFFERENT");
+}
+
+int start4(char *arg)
+{
+    int result, status = -1;
+    int i;
+
+    USLOSS_Console("start4(): started\n");
+
+    for (i = 0; i < sizeof(out); i++)
+        out[i] = 'A' + (i / 512) % 26 + i % 3;
+    DiskWrite(out, 0, 2, 0, SECTORS, &status);
+    USLOSS_Console("start4(): DiskWrite to unit 0: status %d\n", status);
+
+    result = DiskCopy(0, 2, 0, 1, 7, 5, SECTORS, &status);
+    USLOSS_Console("start4(): DiskCopy to unit 1: result %d, status %d\n", result, status);
+    check("unit 1, track 7, block 5", 1, 7, 5, SECTORS, out);
+
+    result = DiskCopy(1, 7, 5, 1, 7, 12, SECTORS, &status);
+    USLOSS_Console("start4(): DiskCopy 7 sectors further on: result %d, status %d\n", result, status);
+    check("unit 1, track 7, block 12", 1, 7, 12, SECTORS, out);
+
+    result = DiskCopy(1, 7, 12, 1, 6, 14, SECTORS, &status);
+    USLOSS_Console("start4(): DiskCopy 14 sectors further back: result %d, status %d\n", result, status);
+    check("unit 1, track 6, block 14", 1, 6, 14, SECTORS, out);
+
+    result = DiskCopy(0, 2, 0, DISK_MIRROR_UNIT, 12, 8, 4, &status);
+    USLOSS_Console("start4(): DiskCopy to the mirror: result %d, status %d\n", result, status);
+    check("unit 0, track 12, block 8", 0, 12, 8, 4, out);
+    check("unit 1, track 12, block 8", 1, 12, 8, 4, out);
+
+    DiskWrite(out + 16*512, 0, 15, 8, 8, &status);
+    result = DiskCopy(1, 6, 14, 0, 15, 8, 9, &status);
+    USLOSS_Console("start4(): DiskCopy past the end of unit 0: result %d, status is USLOSS_DEV_ERROR: %s\n",
+                   result, status == USLOSS_DEV_ERROR ? "yes" : "no");
+    check("unit 0, track 15, block 8, unchanged", 0, 15, 8, 8, out + 16*512);
+
+    result = DiskCopy(2, 0, 0, 1, 0, 0, 1, &status);
+    USLOSS_Console("start4(): DiskCopy from unit 2: result %d\n", result);
+    result = DiskCopy(0, 0, 16, 1, 0, 0, 1, &status);
+    USLOSS_Console("start4(): DiskCopy from block 16: result %d\n", result);
+    result = DiskCopy(0, 0, 0, 1, -1, 0, 1, &status);
+    USLOSS_Console("start4(): DiskCopy to track -1: result %d\n", result);
+    result = DiskCopy(0, 0, 0, 1, 0, 0, -1, &status);
+    USLOSS_Console("start4(): DiskCopy of -1 sectors: result %d\n", result);
+
+    Terminate(0);
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <usloss.h>
+#include <usyscall.h>
+
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3.h>
+#include <phase3_usermode.h>
+#include <phase4.h>
+#include <phase4_usermode.h>
+
+/* DiskFill and DiskZero: fills and zeroes ranges on a physical unit and on
+ * the mirror and reads them back. Two children fill the two halves of a
+ * track at once with different patterns, so their requests can be merged;
+ * each half must still get its own pattern. Fills running past the end of
+ * the mirrored and striped units fail with nothing written, and bad
+ * arguments return -1.
+ */
+
+static char in[16*512];
+static char old[16*512];
+
+static int filled(char *buffer, int sectors, int pattern)
+{
+    int i;
+
+    for (i = 0; i < sectors*512; i++)
+        if (buffer[i] != (char) pattern)
+            return 0;
+    return 1;
+}
+
+static void check(char *what, int unit, int track, int first, int sectors,
+                  int pattern)
+{
+    int status = -1;
+
+    memset(in, 0xff, sizeof(in));
+    DiskRead(in, unit, track, first, sectors, &status);
+    USLOSS_Console("start4(): %s: status %d, %s\n", what, status,
+                   filled(in, sectors, pattern) ? "filled" : "WRONG");
+}
+
+static void unchanged(char *what, int unit, int track, int first, int sectors)
+{
+    int status = -1;
+
+    memset(in, 0, sizeof(in));
+    DiskRead(in, unit, track, first, sectors, &status);
+    USLOSS_Console("start4(): %s: status %d, %s\n", what, status,
+                   memcmp(in, old, sectors*512) == 0 ? "unchanged" : "CHANGED");
+}
+
+int Child(char *arg)
+{
+    int half = atoi(arg);
+    int status = -1;
+
+    DiskFill(1, 5, half*8, 8, 0x11*(half + 1), &status);
+    Terminate(status);
+    return 0;
+}
+
+int start4(char *arg)
+{
+    int result, status = -1, pid, i;
+
+    USLOSS_Console("start4(): started\n");
+
+    for (i = 0; i < sizeof(old); i++)
+        old[i] = 'a' + i % 19;
+
+    DiskWrite(old, 0, 3, 0, 8, &status);
+    result = DiskFill(0, 3, 0, 8, 0x5a, &status);
+    USLOSS_Console("start4(): DiskFill on unit 0: result %d, status %d\n", result, status);
+    check("unit 0, track 3, blocks 0-7", 0, 3, 0, 8, 0x5a);
+    result = DiskZero(0, 3, 4, 2, &status);
+    USLOSS_Console("start4(): DiskZero on unit 0: result %d, status %d\n", result, status);
+    check("unit 0, track 3, blocks 0-3", 0, 3, 0, 4, 0x5a);
+    check("unit 0, track 3, blocks 4-5", 0, 3, 4, 2, 0);
+    check("unit 0, track 3, blocks 6-7", 0, 3, 6, 2, 0x5a);
+
+    result = DiskFill(DISK_MIRROR_UNIT, 9, 12, 6, 0x33, &status);
+    USLOSS_Console("start4(): DiskFill on the mirror: result %d, status %d\n", result, status);
+    check("unit 0, track 9, block 12", 0, 9, 12, 6, 0x33);
+    check("unit 1, track 9, block 12", 1, 9, 12, 6, 0x33);
+
+    Spawn("Child0", Child, "0", USLOSS_MIN_STACK, 4, &pid);
+    Spawn("Child1", Child, "1", USLOSS_MIN_STACK, 4, &pid);
+    for (i = 0; i < 2; i++) {
+        Wait(&pid, &status);
+        USLOSS_Console("start4(): child's DiskFill: status %d\n", status);
+    }
+    check("unit 1, track 5, blocks 0-7", 1, 5, 0, 8, 0x11);
+    check("unit 1, track 5, blocks 8-15", 1, 5, 8, 8, 0x22);
+
+    DiskWrite(old, DISK_MIRROR_UNIT, 15, 12, 4, &status);
+    result = DiskFill(DISK_MIRROR_UNIT, 15, 12, 8, 0x44, &status);
+    USLOSS_Console("start4(): DiskFill past the end of the mirror: result %d, status is USLOSS_DEV_ERROR: %s\n",
+                   result, status == USLOSS_DEV_ERROR ? "yes" : "no");
+    unchanged("unit 0, track 15, block 12", 0, 15, 12, 4);
+    unchanged("unit 1, track 15, block 12", 1, 15, 12, 4);
+
+    DiskWrite(old, DISK_STRIPE_UNIT, 30, 0, 16, &status);
+    result = DiskFill(DISK_STRIPE_UNIT, 30, 0, 33, 0x44, &status);
+    USLOSS_Console("start4(): DiskFill past the end of the stripe: result %d, status is USLOSS_DEV_ERROR: %s\n",
+                   result, status == USLOSS_DEV_ERROR ? "yes" : "no");
+    unchanged("unit 0, track 15", 0, 15, 0, 16);
+
+    result = DiskFill(0, 0, 0, 1, 256, &status);
+    USLOSS_Console("start4(): DiskFill with pattern 256: result %d\n", result);
+    result = DiskFill(0, 0, 0, 1, -1, &status);
+    USLOSS_Console("start4(): DiskFill with pattern -1: result %d\n", result);
+    result = DiskFill(3, 0, 0, 1, 0, &status);
+    USLOSS_Console("start4(): DiskFill on unit 3: result %d\n", result);
+    result = DiskFill(0, 0, 16, 1, 0, &status);
+    USLOSS_Console("start4(): DiskFill from block 16: result %d\n", result);
+    result = DiskZero(0, 0, 0, -1, &status);
+    USLOSS_Console("start4(): DiskZero of -1 sectors: result %d\n", result);
+
+    Terminate(0);
+    return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ * Offline disk scheduler simulator.
+ *
+ * Replays the requests of a disk trace (see DiskTrace() and
+ * tools/disktrace.c) against a model of one USLOSS disk, once per policy,
+ * and reports throughput, seek distance and latency percentiles. The
+ * "phase4" policy is the kernel's own scheduler: phase4_disk_sched.c is
+ * linked in unchanged and driven the way disk_daemon drives it, including
+ * same-track piggybacking. fifo, sstf and cscan are there for comparison.
+ *
+ *	make tools/disksim
+ *	tools/disksim -o $((20*16*512)) disk1         replay a dump
+ *	tools/disksim -g 8:50                          8 processes x 50 random requests
+ *
+ * A process's request that was issued after its previous one completed is
+ * replayed the same think time after the simulated completion, so faster
+ * policies also get requests sooner. Other requests keep their recorded
+ * arrival times. Read-ahead and its cache are not modelled.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../phase4_disk_sched.h"
+
+#define MAX_REQUESTS 4096
+
+typedef struct sim_request {
+	int pid;
+	int id;                 // recorded trace id
+	int merged_into;        // id of the fill it finished with, or 0
+	int operation;
+	int track;
+	int block;
+	int sectors;
+	int recorded_arrive;
+	int recorded_complete;
+	int after;              // request this one waits for, or -1
+	int think;              // time after that request completes
+	int issue;              // simulated arrival, -1 until known
+	int admitted;
+	int complete;
+	disk_list_node node;
+} sim_request;
+
+enum { POLICY_FIFO, POLICY_SSTF, POLICY_CSCAN, POLICY_PHASE4, POLICIES };
+static const char* policy_names[POLICIES] = { "fifo", "sstf", "cscan", "phase4" };
+
+// Disk model, in us
+static int seek_base = 240;
+static int seek_per_track = 210;
+static int sector_time = 280;
+
+static sim_request requests[MAX_REQUESTS];
+static int request_count;
+
+// State the scheduler works on
+disk_list_node* disk_read_queue[2];
+disk_list_node* disk_write_queue[2];
+int disk_batch_op[2];
+int disk_batch_count[2];
+int disk_head_track[2];
+int disk_stalled[2];
+static disk_list_node* active;
+static int now;
+
+int currentTime(void){
+	return now;
+}
+
+disk_list_node** disk_queue(int unit){
+	return &active;
+}
+
+proc_data* proc_find(int pid){
+	return NULL;
+}
+
+int proc_get_priority(int pid){
+	return DEFAULT_PRIORITY;
+}
+
+void disk_trace(int unit, int event, disk_list_node* node, int arg){
+}
+
+static void usage(const char* prog){
+	fprintf(stderr,
+		"usage: %s [-o byte_offset] [-n records] trace_file\n"
+		"       %s -g processes:requests [-t tracks]\n"
+		"options: -P policy[,policy...]  -s seek_base_us  -p seek_per_track_us  -x sector_us\n",
+		prog, prog);
+	exit(1);
+}
+
+/**
+* Loads the requests of a trace dump. Each arrival becomes a request; its
+* completion is the one with the same id, or for a fill merged into another
+* request, that request's.
+*/
+static void load_trace(const char* path, long offset, long limit){
+	FILE* f = fopen(path, "rb");
+	if(f==NULL || fseek(f, offset, SEEK_SET)!=0){
+		perror(path);
+		exit(1);
+	}
+	static const disk_trace_record zero;
+	disk_trace_record rec;
+	long count = 0;
+	int start = -1;
+	while((limit<0 || count++<limit) && fread(&rec, sizeof(rec), 1, f)==1){
+		if(memcmp(&rec, &zero, sizeof(rec))==0)
+			break;
+		if(start<0)
+			start = rec.time;
+		if(rec.event==DISK_TRACE_ARRIVE && request_count<MAX_REQUESTS){
+			sim_request* req = &requests[request_count++];
+			memset(req, 0, sizeof(*req));
+			req->pid = rec.pid;
+			req->id = rec.id;
+			req->operation = rec.operation;
+			req->track = rec.track;
+			req->block = rec.block;
+			req->sectors = rec.arg;
+			req->recorded_arrive = rec.time - start;
+			req->recorded_complete = -1;
+		}
+		else if(rec.event==DISK_TRACE_MERGE){
+			for(int i=request_count-1; i>=0; i--){
+				if(requests[i].id==rec.id){
+					requests[i].merged_into = rec.arg;
+					break;
+				}
+			}
+		}
+		else if(rec.event==DISK_TRACE_COMPLETE){
+			for(int i=0; i<request_count; i++){
+				sim_request* req = &requests[i];
+				if((req->id==rec.id || req->merged_into==rec.id) && req->recorded_complete<0)
+					req->recorded_complete = rec.time - start;
+			}
+		}
+	}
+	fclose(f);
+
+	// Work out which requests were issued in reaction to a completion
+	for(int i=0; i<request_count; i++){
+		requests[i].after = -1;
+		for(int j=i-1; j>=0; j--){
+			if(requests[j].pid!=requests[i].pid)
+				continue;
+			if(requests[j].recorded_complete>=0 && requests[j].recorded_complete<=requests[i].recorded_arrive){
+				requests[i].after = j;
+				requests[i].think = requests[i].recorded_arrive - requests[j].recorded_complete;
+			}
+			break;
+		}
+	}
+}
+
+/**
+* Makes up a closed-loop random workload: each process issues its requests
+* back to back at random places on the disk, 1 to 8 sectors, 30% writes.
+*/
+static void generate(int processes, int per_process, int tracks){
+	srand(452);
+	for(int p=0; p<processes; p++){
+		for(int i=0; i<per_process && request_count<MAX_REQUESTS; i++){
+			sim_request* req = &requests[request_count];
+			memset(req, 0, sizeof(*req));
+			req->pid = p+1;
+			req->operation = rand()%10 < 3 ? WRITE : READ;
+			req->track = rand()%tracks;
+			req->block = rand()%16;
+			req->sectors = 1 + rand()%8;
+			if(req->track*16 + req->block + req->sectors > tracks*16)
+				req->sectors = tracks*16 - (req->track*16 + req->block);
+			req->after = i==0 ? -1 : request_count-1;
+			req->think = 0;
+			request_count++;
+		}
+	}
+}
+
+static int seek_cost(int distance){
+	return distance==0 ? 0 : seek_base + seek_per_track*distance;
+}
+
+/**
+* Queues every request whose arrival time has come. Returns the earliest
+* arrival still in the future, or -1.
+*/
+static int admit(int policy){
+	int next = -1;
+	for(int i=0; i<request_count; i++){
+		sim_request* req = &requests[i];
+		if(req->admitted || req->issue<0)
+			continue;
+		if(req->issue > now){
+			if(next<0 || req->issue<next)
+				next = req->issue;
+			continue;
+		}
+		req->admitted = 1;
+		disk_list_node* node = &req->node;
+		memset(node, 0, sizeof(*node));
+		node->pid = req->pid;
+		node->operation = req->operation;
+		node->track = req->track;
+		node->start_block = req->block;
+		node->sectors = req->sectors;
+		node->queued_time = req->issue;
+		if(policy==POLICY_PHASE4 && node->operation==WRITE)
+			disk_queue_append(&disk_write_queue[0], node);
+		else
+			disk_queue_append(&disk_read_queue[0], node);
+	}
+	return next;
+}
+
+/**
+* Takes the next request for the comparison policies, which keep reads and
+* writes in a single queue
+*/
+static disk_list_node* pick(int policy){
+	disk_list_node** queue = &disk_read_queue[0];
+	disk_list_node** best = queue;
+	if(policy==POLICY_CSCAN){
+		disk_list_node* node = disk_cscan_take(queue, disk_head_track[0], disk_best_class(*queue, now), now);
+		node->next = active;
+		active = node;
+		return node;
+	}
+	if(policy==POLICY_SSTF){
+		for(disk_list_node** link = queue; *link!=NULL; link = &(*link)->next)
+			if(abs((*link)->track - disk_head_track[0]) < abs((*best)->track - disk_head_track[0]))
+				best = link;
+	}
+	disk_list_node* node = *best;
+	*best = node->next;
+	node->next = active;
+	active = node;
+	return node;
+}
+
+static void finish(disk_list_node* node){
+	sim_request* req = (sim_request*)((char*)node - offsetof(sim_request, node));
+	req->complete = now;
+	active = node->next;
+	for(int i=0; i<request_count; i++)
+		if(requests[i].after==req-requests)
+			requests[i].issue = now + requests[i].think;
+}
+
+static void transfer(disk_list_node* node){
+	while(node->sectors_done < node->sectors && node->start_block < 16){
+		now += sector_time;
+		node->sectors_done++;
+		node->start_block++;
+	}
+}
+
+static int compare_int(const void* a, const void* b){
+	return *(const int*)a - *(const int*)b;
+}
+
+static void run(int policy){
+	memset(disk_read_queue, 0, sizeof(disk_read_queue));
+	memset(disk_write_queue, 0, sizeof(disk_write_queue));
+	disk_batch_op[0] = READ;
+	disk_batch_count[0] = 0;
+	disk_head_track[0] = 0;
+	disk_stalled[0] = 0;
+	active = NULL;
+	now = 0;
+	for(int i=0; i<request_count; i++){
+		requests[i].admitted = 0;
+		requests[i].issue = requests[i].after<0 ? requests[i].recorded_arrive : -1;
+	}
+
+	long seek_distance = 0;
+	int seeks = 0;
+	long sectors = 0;
+	int done = 0;
+	while(done < request_count){
+		int next = admit(policy);
+		disk_list_node* curr;
+		if(policy==POLICY_PHASE4)
+			curr = disk_dispatch(0);
+		else
+			curr = disk_read_queue[0]==NULL ? NULL : pick(policy);
+		if(curr==NULL){
+			if(next<0){
+				fprintf(stderr, "%s: stuck with %d of %d requests done\n", policy_names[policy], done, request_count);
+				break;
+			}
+			now = next;
+			continue;
+		}
+
+		int distance = abs(curr->track - disk_head_track[0]);
+		if(distance>0){
+			seeks++;
+			seek_distance += distance;
+		}
+		now += seek_cost(distance);
+		disk_head_track[0] = curr->track;
+
+		while(1){
+			transfer(curr);
+			if(curr->sectors_done==curr->sectors)
+				break;
+
+			// At the end of a track, as disk_daemon does
+			admit(policy);
+			disk_list_node* same_track = NULL;
+			if(policy==POLICY_PHASE4 && curr->piggybacks<DISK_PIGGYBACK_MAX)
+				same_track = disk_take_same_track(0, curr);
+			if(same_track!=NULL){
+				curr->piggybacks++;
+				transfer(same_track);
+				sectors += same_track->sectors;
+				finish(same_track);
+				done++;
+				continue;
+			}
+			curr->track++;
+			curr->start_block = 0;
+			curr->piggybacks = 0;
+			seeks++;
+			seek_distance++;
+			now += seek_cost(1);
+			disk_head_track[0] = curr->track;
+		}
+		sectors += curr->sectors;
+		finish(curr);
+		done++;
+	}
+
+	int latencies[MAX_REQUESTS];
+	int first = -1;
+	int last = 0;
+	for(int i=0; i<done; i++){
+		latencies[i] = requests[i].complete - requests[i].issue;
+		if(first<0 || requests[i].issue<first)
+			first = requests[i].issue;
+		if(requests[i].complete>last)
+			last = requests[i].complete;
+	}
+	qsort(latencies, done, sizeof(int), compare_int);
+	double seconds = (last-first)/1000000.0;
+	if(done==0 || seconds<=0)
+		return;
+	printf("%-7s %6d %10.1f %8.1f %9.1f %6d %9ld %7d %7d %7d %7d\n",
+		policy_names[policy], done, seconds*1000, done/seconds, sectors/seconds,
+		seeks, seek_distance,
+		latencies[done/2], latencies[done*9/10], latencies[done*99/100], latencies[done-1]);
+}
+
+int main(int argc, char** argv){
+	long offset = 0;
+	long limit = -1;
+	int processes = 0, per_process = 0, tracks = 16;
+	int run_policy[POLICIES] = { 1, 1, 1, 1 };
+	int opt;
+	while((opt = getopt(argc, argv, "o:n:g:t:P:s:p:x:")) != -1){
+		switch(opt){
+		case 'o': offset = strtol(optarg, NULL, 0); break;
+		case 'n': limit = strtol(optarg, NULL, 0); break;
+		case 'g':
+			if(sscanf(optarg, "%d:%d", &processes, &per_process)!=2 || processes<=0 || per_process<=0)
+				usage(argv[0]);
+			break;
+		case 't': tracks = atoi(optarg); break;
+		case 's': seek_base = atoi(optarg); break;
+		case 'p': seek_per_track = atoi(optarg); break;
+		case 'x': sector_time = atoi(optarg); break;
+		case 'P':
+			memset(run_policy, 0, sizeof(run_policy));
+			for(char* name = strtok(optarg, ","); name!=NULL; name = strtok(NULL, ",")){
+				int found = 0;
+				for(int i=0; i<POLICIES; i++){
+					if(strcmp(name, policy_names[i])==0){
+						run_policy[i] = 1;
+						found = 1;
+					}
+				}
+				if(!found)
+					usage(argv[0]);
+			}
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if(processes>0 && optind==argc)
+		generate(processes, per_process, tracks);
+	else if(processes==0 && optind==argc-1)
+		load_trace(argv[optind], offset, limit);
+	else
+		usage(argv[0]);
+	if(request_count==0){
+		fprintf(stderr, "no requests to replay\n");
+		return 1;
+	}
+
+	printf("%-7s %6s %10s %8s %9s %6s %9s %7s %7s %7s %7s\n",
+		"policy", "reqs", "time(ms)", "req/s", "sectors/s", "seeks", "seek-dist",
+		"p50(us)", "p90(us)", "p99(us)", "max(us)");
+	for(int i=0; i<POLICIES; i++)
+		if(run_policy[i])
+			run(i);
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Host-side tool that prints a disk trace snapshot as a timeline.
+ *
+ * Take a snapshot with DiskTrace() in a testcase and store the records
+ * somewhere the host can read them, e.g. write them to a spare track:
+ *
+ *	DiskTrace(0, records, DISK_TRACE_RECORDS, &count, &lost);
+ *	DiskWrite(records, 1, 20, 0, (count*sizeof(disk_trace_record)+511)/512, &status);
+ *
+ * then, on the host:
+ *
+ *	make tools/disktrace
+ *	tools/disktrace -o $((20*16*512)) disk1
+ *
+ * Records are read until end of file, an all-zero record, or -n records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../phase4.h"
+
+#define MAX_IDS 1024
+
+static const char* event_name(int event){
+	switch(event){
+	case DISK_TRACE_ARRIVE:    return "arrive";
+	case DISK_TRACE_DISPATCH:  return "dispatch";
+	case DISK_TRACE_SEEK:      return "seek";
+	case DISK_TRACE_SECTOR:    return "sector";
+	case DISK_TRACE_COMPLETE:  return "complete";
+	case DISK_TRACE_CACHE_HIT: return "cache-hit";
+	case DISK_TRACE_PREFETCH:  return "prefetch";
+	case DISK_TRACE_MERGE:     return "merge";
+	}
+	return "?";
+}
+
+static void usage(const char* prog){
+	fprintf(stderr, "usage: %s [-o byte_offset] [-n records] file\n", prog);
+	exit(1);
+}
+
+int main(int argc, char** argv){
+	long offset = 0;
+	long limit = -1;
+	int opt;
+	while((opt = getopt(argc, argv, "o:n:")) != -1){
+		if(opt=='o')
+			offset = strtol(optarg, NULL, 0);
+		else if(opt=='n')
+			limit = strtol(optarg, NULL, 0);
+		else
+			usage(argv[0]);
+	}
+	if(optind != argc-1)
+		usage(argv[0]);
+
+	FILE* f = fopen(argv[optind], "rb");
+	if(f==NULL || fseek(f, offset, SEEK_SET)!=0){
+		perror(argv[optind]);
+		return 1;
+	}
+
+	// Arrival time of each outstanding request by id, to report latency
+	int arrived[MAX_IDS];
+	memset(arrived, -1, sizeof(arrived));
+
+	static const disk_trace_record zero;
+	disk_trace_record rec;
+	long count = 0;
+	int first = 0, last = 0;
+	int head = -1;
+	long seeks = 0, seek_distance = 0;
+	long completed = 0, latency_total = 0;
+	int latency_max = 0;
+
+	printf("%10s %8s %5s %6s %-5s %-9s %5s %5s  %s\n",
+		"time(us)", "+delta", "pid", "id", "op", "event", "track", "block", "detail");
+	while((limit<0 || count<limit) && fread(&rec, sizeof(rec), 1, f)==1){
+		if(memcmp(&rec, &zero, sizeof(rec))==0)
+			break;
+		if(count==0)
+			first = last = rec.time;
+
+		char detail[64] = "";
+		int slot = rec.id % MAX_IDS;
+		switch(rec.event){
+		case DISK_TRACE_ARRIVE:
+			arrived[slot] = rec.time;
+			snprintf(detail, sizeof(detail), "%d sectors", rec.arg);
+			break;
+		case DISK_TRACE_DISPATCH:
+			if(rec.arg)
+				snprintf(detail, sizeof(detail), "piggybacked");
+			break;
+		case DISK_TRACE_SEEK:
+			if(head>=0){
+				seeks++;
+				seek_distance += abs(rec.arg - head);
+				snprintf(detail, sizeof(detail), "distance %d", abs(rec.arg - head));
+			}
+			head = rec.arg;
+			break;
+		case DISK_TRACE_COMPLETE:
+			if(arrived[slot]>=0){
+				int latency = rec.time - arrived[slot];
+				snprintf(detail, sizeof(detail), "status %d, latency %d us", rec.arg, latency);
+				completed++;
+				latency_total += latency;
+				if(latency > latency_max)
+					latency_max = latency;
+				arrived[slot] = -1;
+			}
+			else
+				snprintf(detail, sizeof(detail), "status %d", rec.arg);
+			break;
+		case DISK_TRACE_CACHE_HIT:
+		case DISK_TRACE_PREFETCH:
+			snprintf(detail, sizeof(detail), "%d sectors", rec.arg);
+			break;
+		case DISK_TRACE_MERGE:
+			// Finishes with the request it joined, which is timed
+			arrived[slot] = -1;
+			snprintf(detail, sizeof(detail), "into %d", rec.arg);
+			break;
+		}
+
+		printf("%10d %+8d %5d %6d %-5s %-9s %5d %5d  %s\n",
+			rec.time, rec.time - last, rec.pid, rec.id, rec.operation ? "write" : "read",
+			event_name(rec.event), rec.track, rec.block, detail);
+		last = rec.time;
+		count++;
+	}
+	fclose(f);
+
+	printf("\n%ld records over %d us\n", count, last - first);
+	printf("%ld seeks, %ld tracks total\n", seeks, seek_distance);
+	if(completed>0)
+		printf("%ld requests completed, latency avg %ld us, max %d us\n",
+			completed, latency_total/completed, latency_max);
+	return 0;
+}
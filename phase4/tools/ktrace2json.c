@@ -0,0 +1,134 @@
+/*
+ * Host-side tool that converts kernel trace snapshots into Chrome
+ * trace-event JSON, for chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Build the kernel with the tracepoints wanted (make KTRACE_MASK=7), take
+ * snapshots with KTrace() in a testcase and store them where the host can
+ * read them, one subsystem after another, e.g. on a spare track:
+ *
+ *	KTrace(KTRACE_SLEEP, records, KTRACE_RECORDS, &count, &lost);
+ *	KTrace(KTRACE_TERM, records+count, KTRACE_RECORDS, &more, &lost);
+ *	DiskWrite(records, 1, 20, 0, ((count+more)*sizeof(ktrace_record)+511)/512, &status);
+ *
+ * then, on the host:
+ *
+ *	make tools/ktrace2json
+ *	tools/ktrace2json -o $((20*16*512)) disk1 > trace.json
+ *
+ * Records are read until end of file, an all-zero record, or -n records.
+ * Calls into the kernel become duration events on the calling process's
+ * row; everything else is an instant event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../phase4.h"
+
+#define MAX_RECORDS (KTRACE_SUBSYSTEMS*KTRACE_RECORDS*16)
+
+static ktrace_record records[MAX_RECORDS];
+
+static const char* event_name(int event){
+	switch(event){
+	case KTRACE_SLEEP_ENTER:
+	case KTRACE_SLEEP_RETURN:     return "Sleep";
+	case KTRACE_SLEEP_WAKE:       return "wake";
+	case KTRACE_DISK_READ:        return "DiskRead";
+	case KTRACE_DISK_WRITE:       return "DiskWrite";
+	case KTRACE_DISK_DONE:        return "disk-done";
+	case KTRACE_DISK_INTERRUPT:   return "disk-interrupt";
+	case KTRACE_TERM_READ:
+	case KTRACE_TERM_READ_DONE:   return "TermRead";
+	case KTRACE_TERM_WRITE:
+	case KTRACE_TERM_WRITE_DONE:  return "TermWrite";
+	case KTRACE_TERM_LINE_IN:     return "line-in";
+	case KTRACE_TERM_LINE_DROP:   return "line-dropped";
+	case KTRACE_TERM_LINE_OUT:    return "line-out";
+	}
+	return "?";
+}
+
+// 'B' and 'E' bracket a system call, 'i' is a point in time
+static char phase(int event){
+	switch(event){
+	case KTRACE_SLEEP_ENTER:
+	case KTRACE_DISK_READ:
+	case KTRACE_DISK_WRITE:
+	case KTRACE_TERM_READ:
+	case KTRACE_TERM_WRITE:
+		return 'B';
+	case KTRACE_SLEEP_RETURN:
+	case KTRACE_DISK_DONE:
+	case KTRACE_TERM_READ_DONE:
+	case KTRACE_TERM_WRITE_DONE:
+		return 'E';
+	}
+	return 'i';
+}
+
+static int by_time(const void* a, const void* b){
+	const ktrace_record* x = a;
+	const ktrace_record* y = b;
+	if(x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	return x->seq - y->seq;
+}
+
+static void usage(const char* prog){
+	fprintf(stderr, "usage: %s [-o byte_offset] [-n records] file\n", prog);
+	exit(1);
+}
+
+int main(int argc, char** argv){
+	long offset = 0;
+	long limit = MAX_RECORDS;
+	int opt;
+	while((opt = getopt(argc, argv, "o:n:")) != -1){
+		if(opt=='o')
+			offset = strtol(optarg, NULL, 0);
+		else if(opt=='n')
+			limit = strtol(optarg, NULL, 0);
+		else
+			usage(argv[0]);
+	}
+	if(optind != argc-1 || limit < 0 || limit > MAX_RECORDS)
+		usage(argv[0]);
+
+	FILE* f = fopen(argv[optind], "rb");
+	if(f == NULL){
+		perror(argv[optind]);
+		return 1;
+	}
+	if(fseek(f, offset, SEEK_SET) != 0){
+		perror("fseek");
+		return 1;
+	}
+
+	static const ktrace_record zero;
+	int n = 0;
+	while(n < limit && fread(&records[n], sizeof(ktrace_record), 1, f) == 1){
+		if(memcmp(&records[n], &zero, sizeof(zero)) == 0)
+			break;
+		n++;
+	}
+	fclose(f);
+
+	// Subsystems were dumped one after the other; put them back in order
+	qsort(records, n, sizeof(ktrace_record), by_time);
+
+	printf("{\"traceEvents\":[\n");
+	for(int i=0; i<n; i++){
+		ktrace_record* r = &records[i];
+		char ph = phase(r->event);
+		printf("{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%d,\"pid\":1,\"tid\":%d,%s"
+		       "\"args\":{\"arg1\":%d,\"arg2\":%d}}%s\n",
+		       event_name(r->event), ph, r->time, r->pid,
+		       ph=='i' ? "\"s\":\"t\"," : "",
+		       r->arg1, r->arg2, i+1<n ? "," : "");
+	}
+	printf("],\"displayTimeUnit\":\"ms\"}\n");
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Host-side tool that writes large term0.in-term3.in files for the
+ * terminal benchmark (testcases/bench07.c).
+ *
+ * Each terminal gets -n numbered lines of -l characters (newline included):
+ *
+ *	T2 00017 abcdefg...\n
+ *
+ * followed by END_LINES copies of "T2 end <n>\n". The reader stops at the
+ * first end line and counts any numbers it never saw as dropped; there are
+ * several end lines so that one of them still gets through if the kernel's
+ * line buffer is full when the first arrives.
+ *
+ *	make tools/termgen
+ *	tools/termgen -n 500 -l 72
+ *
+ * 'make bench' does this itself and puts the original files back after.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TERMINALS 4
+#define END_LINES 16
+
+/* keep in step with MAXLINE in phase2.h */
+#define MAX_LINE 80
+
+static void usage(const char* prog){
+	fprintf(stderr, "usage: %s [-n lines] [-l line_length] [-d directory]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char** argv){
+	int lines = 500;
+	int length = 72;
+	const char* dir = ".";
+	int opt;
+	while((opt = getopt(argc, argv, "n:l:d:")) != -1){
+		if(opt=='n')
+			lines = atoi(optarg);
+		else if(opt=='l')
+			length = atoi(optarg);
+		else if(opt=='d')
+			dir = optarg;
+		else
+			usage(argv[0]);
+	}
+	// "T0 00000 " plus at least one letter and the newline
+	if(optind != argc || lines < 0 || lines > 99999 || length < 11 || length >= MAX_LINE)
+		usage(argv[0]);
+
+	for(int term=0; term<TERMINALS; term++){
+		char name[256];
+		snprintf(name, sizeof(name), "%s/term%d.in", dir, term);
+		FILE* f = fopen(name, "w");
+		if(f == NULL){
+			perror(name);
+			return 1;
+		}
+		for(int i=0; i<lines; i++){
+			int n = fprintf(f, "T%d %05d ", term, i);
+			for(; n < length-1; n++)
+				fputc('a' + (i+n) % 26, f);
+			fputc('\n', f);
+		}
+		for(int i=0; i<END_LINES; i++)
+			fprintf(f, "T%d end %d\n", term, lines);
+		fclose(f);
+	}
+	return 0;
+}